@@ -1,19 +1,296 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool --------------===//
 //===----------------------------------------------------------------------===//
 
+#include <fstream>
+#include <iostream>
+#include <thread>
+
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
 #include "ASTInterpreter.h"
+#include "BatchServer.h"
+#include "BytecodeCompiler.h"
+#include "ConstantFolder.h"
+#include "ForkServer.h"
+#include "Interpreter.h"
+#include "ProgramCache.h"
+#include "VM.h"
 // #include "util.h"
 
 using namespace clang;
 
+enum ExecEngine
+{
+   AST_ENGINE,
+   BYTECODE_ENGINE
+};
+
+static llvm::cl::opt<ExecEngine>
+    Engine("engine", llvm::cl::desc("Execution engine"),
+           llvm::cl::values(clEnumValN(AST_ENGINE, "ast", "walk the clang AST on every execution"),
+                            clEnumValN(BYTECODE_ENGINE, "bytecode", "lower each function to bytecode once and run it on the VM")),
+           llvm::cl::init(BYTECODE_ENGINE));
+
+static llvm::cl::opt<VM::JitMode>
+    Jit("jit", llvm::cl::desc("Native code tier of the bytecode engine"),
+        llvm::cl::values(clEnumValN(VM::JIT_OFF, "off", "interpret only"),
+                         clEnumValN(VM::JIT_TIERED, "tiered", "compile functions with LLVM once they get hot"),
+                         clEnumValN(VM::JIT_ALWAYS, "always", "compile every function before main runs")),
+        llvm::cl::init(VM::JIT_TIERED));
+
+static llvm::cl::opt<bool>
+    FoldConstants("fold-constants", llvm::cl::desc("Fold constants, dead branches and identities before running"),
+                  llvm::cl::init(true));
+
+static llvm::cl::opt<unsigned>
+    JitThreshold("jit-threshold", llvm::cl::desc("Calls plus loop back-edges before a function is compiled"),
+                 llvm::cl::init(1000));
+
+static llvm::cl::opt<unsigned>
+    StackBudget("stack-budget", llvm::cl::desc("MiB of guest stack the bytecode engine may use, bounds recursion depth"),
+                llvm::cl::init(1024));
+
+static llvm::cl::opt<bool>
+    SuperinstructionStats("superinstruction-stats",
+                          llvm::cl::desc("Report how often each fused bytecode instruction was emitted and executed"));
+
+static llvm::cl::opt<bool>
+    Memoize("memoize", llvm::cl::desc("Answer repeated calls of pure int functions from a bounded memo table"),
+            llvm::cl::init(true));
+
+static llvm::cl::opt<bool>
+    MemoStats("memo-stats", llvm::cl::desc("Report memo table hits and misses per function"));
+
+static llvm::cl::opt<unsigned>
+    HeapSize("heap-size", llvm::cl::desc("MiB of address space reserved for MALLOC"), llvm::cl::init(4096));
+
+static llvm::cl::opt<bool>
+    HeapStats("heap-stats", llvm::cl::desc("Report live, peak and fragmented guest heap bytes"));
+
+static llvm::cl::opt<bool>
+    Vectorize("vectorize", llvm::cl::desc("Run simple counted loops over int arrays with SIMD kernels"),
+              llvm::cl::init(true));
+
+static llvm::cl::opt<bool>
+    VectorStats("vector-stats", llvm::cl::desc("Report how many loop executions the SIMD kernels took over"));
+
+static llvm::cl::opt<std::string>
+    Profile("profile", llvm::cl::desc("Profile guest statements and functions on the AST walker, write "
+                                      "<prefix>.annotated and <prefix>.folded (flame graph stacks)"),
+            llvm::cl::value_desc("prefix"));
+
+static llvm::cl::opt<std::string>
+    SampleProfile("sample-profile", llvm::cl::desc("Sample the guest call stack on the AST walker, write "
+                                                   "<prefix>.samples and <prefix>.samples.folded (flame graph stacks)"),
+                  llvm::cl::value_desc("prefix"));
+
+static llvm::cl::opt<unsigned>
+    SampleInterval("sample-interval", llvm::cl::desc("Microseconds of CPU time between two samples"),
+                   llvm::cl::init(1000));
+
+static llvm::cl::opt<bool>
+    PerfCounterStats("perf-counters", llvm::cl::desc("Charge host cycles, instructions, cache and branch misses to "
+                                                     "guest functions on the AST walker and report them"));
+
+static llvm::cl::opt<bool>
+    MemStats("mem-stats", llvm::cl::desc("Report frames, arrays and guest heap use of the AST walker and the MALLOC "
+                                         "blocks never freed, by allocating call"));
+
+static llvm::cl::opt<bool>
+    BatchIO("batch-io", llvm::cl::desc("Read GET values in bulk without prompting and buffer PRINT output"));
+
+static llvm::cl::opt<std::string>
+    GetInput("get-input", llvm::cl::desc("File holding the GET values in -batch-io mode, - for stdin"),
+             llvm::cl::value_desc("file"), llvm::cl::init("-"));
+
+static llvm::cl::opt<GuestIO::Stream>
+    PrintTo("print-to", llvm::cl::desc("Stream PRINT writes to"),
+            llvm::cl::values(clEnumValN(GuestIO::STDOUT, "stdout", "standard output"),
+                             clEnumValN(GuestIO::STDERR, "stderr", "standard error")),
+            llvm::cl::init(GuestIO::STDERR));
+
+static llvm::cl::opt<std::string>
+    CacheDir("cache-dir", llvm::cl::desc("Keep lowered programs in this directory and reuse them for unchanged sources"),
+             llvm::cl::value_desc("directory"));
+
+static llvm::cl::opt<bool>
+    Batch("batch", llvm::cl::desc("Treat the positional arguments as source files and run them all in one process, "
+                                  "file names are read from stdin when none are given"));
+
+static llvm::cl::opt<std::string>
+    ForkVectors("fork-server", llvm::cl::desc("Compile the program once and run it in a forked child per line of GET "
+                                              "values in this file, - for stdin"),
+                llvm::cl::value_desc("file"));
+
+static llvm::cl::opt<unsigned>
+    ForkJobs("fork-jobs", llvm::cl::desc("Children -fork-server runs at once, 0 for one per CPU"), llvm::cl::init(0));
+
+static llvm::cl::list<std::string>
+    Inputs(llvm::cl::Positional, llvm::cl::desc("<source code> | <source files> with -batch"), llvm::cl::ZeroOrMore);
+
+static GuestIO::Options ioOptions()
+{
+   GuestIO::Options options;
+   options.batch = BatchIO;
+   options.inputFile = GetInput;
+   options.output = PrintTo;
+   return options;
+}
+
+static VM::Options vmOptions()
+{
+   VM::Options options;
+   options.jit = Jit;
+   options.jitThreshold = JitThreshold;
+   options.stackBudget = (size_t)StackBudget << 20;
+   options.superinstructionStats = SuperinstructionStats;
+   options.memoize = Memoize;
+   options.memoStats = MemoStats;
+   options.heapBytes = (size_t)HeapSize << 20;
+   options.heapStats = HeapStats;
+   options.vectorStats = VectorStats;
+   return options;
+}
+
+static void runProgram(const Program &program)
+{
+   // buffered output is flushed when io goes out of scope
+   GuestIO io(ioOptions());
+   VM vm(program, io, vmOptions());
+   vm.run();
+}
+
+/// compile once, then one forked run per input vector
+static int runForkServer(const std::string &code)
+{
+   Interpreter::Options options;
+   options.bytecode = Engine == BYTECODE_ENGINE;
+   options.foldConstants = FoldConstants;
+   options.vectorize = Vectorize;
+   options.vm = vmOptions();
+   std::string error;
+   std::unique_ptr<CompiledProgram> program = Interpreter(options).compile(code, &error);
+   if (!program)
+   {
+      llvm::errs() << error;
+      return 1;
+   }
+
+   std::ifstream file;
+   if (ForkVectors != "-")
+   {
+      file.open(ForkVectors);
+      if (!file)
+      {
+         llvm::errs() << "cannot read input vectors " << ForkVectors << "\n";
+         return 1;
+      }
+   }
+   unsigned jobs = ForkJobs ? ForkJobs : std::thread::hardware_concurrency();
+   ForkServer server(*program, jobs);
+   return server.sweep(ForkVectors == "-" ? std::cin : file, llvm::outs()) ? 1 : 0;
+}
+
+/// Statements and guest frames exist only in the AST walker, every profiler
+/// and the memory stats run the program on it
+static bool instrumented()
+{
+   return !Profile.empty() || !SampleProfile.empty() || PerfCounterStats || MemStats;
+}
+
+std::string cacheEntryFor(const std::string &code)
+{
+   if (CacheDir.empty() || Engine != BYTECODE_ENGINE || instrumented())
+      return std::string();
+   // options that change the lowering are part of the key
+   std::string options = "bytecode";
+   if (FoldConstants)
+      options += ",fold";
+   if (Vectorize)
+      options += ",vectorize";
+   return ProgramCache(CacheDir).entryFor(code, options);
+}
+
+bool runCached(const std::string &entry)
+{
+   Program program;
+   if (entry.empty() || !ProgramCache::load(entry, program))
+      return false;
+   runProgram(program);
+   return true;
+}
+
+void InterpreterConsumer::HandleTranslationUnit(clang::ASTContext &Context)
+{
+   if (FoldConstants)
+      ConstantFolder(Context).run(Context.getTranslationUnitDecl());
+   if (Engine == BYTECODE_ENGINE && !instrumented())
+   {
+      Program program;
+      BytecodeCompiler compiler(Context, Vectorize);
+      if (compiler.compile(Context.getTranslationUnitDecl(), program))
+      {
+         if (!mCacheEntry.empty())
+            ProgramCache::store(mCacheEntry, program);
+         runProgram(program);
+         return;
+      }
+      // the lowering does not cover this program, walk the AST instead
+   }
+   GuestIO io(ioOptions());
+   mEnv.setMemoization(Memoize, MemoStats);
+   mEnv.setHeap((size_t)HeapSize << 20, HeapStats);
+   mEnv.setProfile(Profile);
+   mEnv.setSampling(SampleProfile, SampleInterval);
+   mEnv.setPerfCounters(PerfCounterStats);
+   mEnv.setMemStats(MemStats);
+   mEnv.initAndRun(Context.getTranslationUnitDecl(), &mVisitor, &io);
+}
+
 int main(int argc, char **argv)
 {
-   if (argc > 1)
+   llvm::cl::ParseCommandLineOptions(argc, argv, "AST interpreter\n");
+
+   if (Batch)
    {
+      if (BatchIO && GetInput == "-")
+      {
+         // the first program would read all of stdin, file names included
+         llvm::errs() << argv[0] << ": -batch reads GET values from a -get-input file, not stdin\n";
+         return 1;
+      }
+      std::vector<std::string> files(Inputs.begin(), Inputs.end());
+      if (files.empty())
+      {
+         std::string line;
+         while (std::getline(std::cin, line))
+            if (!line.empty())
+               files.push_back(line);
+      }
+      BatchServer server;
+      return server.runFiles(files) ? 1 : 0;
+   }
 
-      // std::string code = ReadFileIntoString(argv[1]);
-      // clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), code);
-       clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), argv[1]);
+   if (Inputs.size() != 1)
+   {
+      llvm::errs() << argv[0] << ": expects exactly one <source code> argument\n";
+      return 1;
+   }
+   if (!ForkVectors.empty())
+   {
+      if (instrumented())
+      {
+         // every child would write the same report files and stderr figures
+         llvm::errs() << argv[0] << ": -fork-server does not run -profile, -sample-profile, -perf-counters "
+                                    "or -mem-stats\n";
+         return 1;
+      }
+      return runForkServer(Inputs[0]);
    }
+   // std::string code = ReadFileIntoString(argv[1]);
+   // clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction), code);
+   std::string entry = cacheEntryFor(Inputs[0]);
+   if (runCached(entry))
+      return 0;
+   clang::tooling::runToolOnCode(std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction(entry)), Inputs[0]);
 }
@@ -20,9 +20,6 @@ public:
 
     virtual void VisitBinaryOperator(BinaryOperator *bop)
     {
-        if (mEnv->hasReturn())
-            return;
-
         VisitStmt(bop);
 
 #ifdef DEBUG
@@ -33,8 +30,6 @@ public:
     }
     virtual void VisitDeclRefExpr(DeclRefExpr *expr)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(expr);
 
 #ifdef DEBUG
@@ -46,8 +41,6 @@ public:
     }
     virtual void VisitCastExpr(CastExpr *expr)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(expr);
 #ifdef DEBUG
         expr->dumpColor();
@@ -58,8 +51,6 @@ public:
     }
     virtual void VisitCallExpr(CallExpr *call)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(call);
 #ifdef DEBUG
         call->dumpColor();
@@ -70,8 +61,6 @@ public:
     }
     virtual void VisitDeclStmt(DeclStmt *declstmt)
     {
-        if (mEnv->hasReturn())
-            return;
 #ifdef DEBUG
         declstmt->dumpColor();
         llvm::errs() << "\n";
@@ -83,8 +72,6 @@ public:
     // added visitor --------------------------------------------------------------------
     virtual void VisitIntegerLiteral(IntegerLiteral *integer)
     {
-        if (mEnv->hasReturn())
-            return;
 #ifdef DEBUG
         integer->dumpColor();
         llvm::errs() << "\n";
@@ -92,17 +79,23 @@ public:
         mEnv->integerLiteral(integer);
     }
 
+    virtual void VisitCharacterLiteral(CharacterLiteral *character)
+    {
+        mEnv->characterLiteral(character);
+    }
+
+    virtual void VisitCXXBoolLiteralExpr(CXXBoolLiteralExpr *boolean)
+    {
+        mEnv->boolLiteral(boolean);
+    }
+
     virtual void VisitIfStmt(IfStmt *ifStmt)
     {
-        if (mEnv->hasReturn())
-            return;
         mEnv->ifStmt(ifStmt);
     }
 
     virtual void VisitReturnStmt(ReturnStmt *returnStmt)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(returnStmt);
 #ifdef DEBUG
         returnStmt->dumpColor();
@@ -113,8 +106,6 @@ public:
 
     virtual void VisitUnaryOperator(UnaryOperator *unaryOperator)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(unaryOperator);
 #ifdef DEBUG
         unaryOperator->dumpColor();
@@ -125,22 +116,16 @@ public:
 
     virtual void VisitWhileStmt(WhileStmt *whileStmt)
     {
-        if (mEnv->hasReturn())
-            return;
         mEnv->whileStmt(whileStmt);
     }
 
     virtual void VisitForStmt(ForStmt *forStmt)
     {
-        if (mEnv->hasReturn())
-            return;
         mEnv->forStmt(forStmt);
     }
 
     virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *arraySubscriptExpr)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(arraySubscriptExpr);
 #ifdef DEBUG
         arraySubscriptExpr->dumpColor();
@@ -151,8 +136,6 @@ public:
 
     virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *unaryExprOrTypeTraitExpr)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(unaryExprOrTypeTraitExpr);
 #ifdef DEBUG
         unaryExprOrTypeTraitExpr->dumpColor();
@@ -163,8 +146,6 @@ public:
 
     virtual void VisitParenExpr(ParenExpr *parenExpr)
     {
-        if (mEnv->hasReturn())
-            return;
         VisitStmt(parenExpr);
 #ifdef DEBUG
         parenExpr->dumpColor();
@@ -172,6 +153,32 @@ public:
 #endif
         mEnv->parenExpr(parenExpr);
     }
+    /// Statements of a block run until one of them leaves it; expressions
+    /// cannot, so this is the only place that looks at the control flow state
+    virtual void VisitCompoundStmt(CompoundStmt *compound)
+    {
+        Profiler *profiler = mEnv->getProfiler();
+        for (CompoundStmt::body_iterator it = compound->body_begin(), ie = compound->body_end(); it != ie; ++it)
+        {
+            if (profiler)
+                profiler->enterStmt(*it);
+            Visit(*it);
+            if (profiler)
+                profiler->leaveStmt();
+            if (Sampler::pending())
+                mEnv->takeSample();
+            if (mEnv->isUnwinding())
+                return;
+        }
+    }
+    virtual void VisitBreakStmt(BreakStmt *breakStmt)
+    {
+        mEnv->breakStmt(breakStmt);
+    }
+    virtual void VisitContinueStmt(ContinueStmt *continueStmt)
+    {
+        mEnv->continueStmt(continueStmt);
+    }
     // ----------------------------------------------------------------------------------
 
 private:
@@ -181,29 +188,39 @@ private:
 class InterpreterConsumer : public ASTConsumer
 {
 public:
-    explicit InterpreterConsumer(const ASTContext &context) : mEnv(),
-                                                              mVisitor(context, &mEnv)
+    /// a non-empty cacheEntry receives the lowered program
+    InterpreterConsumer(const ASTContext &context, const std::string &cacheEntry) : mEnv(),
+                                                                                    mVisitor(context, &mEnv),
+                                                                                    mCacheEntry(cacheEntry)
     {
     }
     virtual ~InterpreterConsumer() {}
 
-    virtual void HandleTranslationUnit(clang::ASTContext &Context)
-    {
-        mEnv.initAndRun(Context.getTranslationUnitDecl(), &mVisitor);
-    }
+    virtual void HandleTranslationUnit(clang::ASTContext &Context);
 
 private:
     Environment mEnv;
     InterpreterVisitor mVisitor;
+    std::string mCacheEntry;
 };
 
 class InterpreterClassAction : public ASTFrontendAction
 {
 public:
+    explicit InterpreterClassAction(const std::string &cacheEntry = std::string()) : mCacheEntry(cacheEntry) {}
     virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
         clang::CompilerInstance &Compiler, llvm::StringRef InFile)
     {
         return std::unique_ptr<clang::ASTConsumer>(
-            new InterpreterConsumer(Compiler.getASTContext()));
+            new InterpreterConsumer(Compiler.getASTContext(), mCacheEntry));
     }
-};
\ No newline at end of file
+
+private:
+    std::string mCacheEntry;
+};
+
+/// Program cache entry of code, empty when -cache-dir is unset or the
+/// program is not run by the bytecode engine
+std::string cacheEntryFor(const std::string &code);
+/// Run the cached program of entry, false on a miss
+bool runCached(const std::string &entry);
\ No newline at end of file
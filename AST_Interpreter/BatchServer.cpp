@@ -0,0 +1,65 @@
+#include "BatchServer.h"
+
+#include <chrono>
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "ASTInterpreter.h"
+
+BatchServer::BatchServer() : mRealFiles(llvm::vfs::getRealFileSystem())
+{
+}
+
+bool BatchServer::run(const std::string &name, const std::string &code)
+{
+    std::string entry = cacheEntryFor(code);
+    if (runCached(entry))
+        return true;
+
+    // the source sits in a layer of its own and the FileManager keeps every
+    // file it has seen, both go away with this run so a long batch does not
+    // hold on to all its sources; .cc keeps the language mode of runToolOnCode
+    const std::string fileName = "program.cc";
+    llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> source(new llvm::vfs::InMemoryFileSystem);
+    source->addFile(fileName, 0, llvm::MemoryBuffer::getMemBufferCopy(code, name));
+    llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> overlay(new llvm::vfs::OverlayFileSystem(mRealFiles));
+    overlay->pushOverlay(source);
+    llvm::IntrusiveRefCntPtr<clang::FileManager> files(new clang::FileManager(clang::FileSystemOptions(), overlay));
+
+    std::vector<std::string> args;
+    args.push_back("ast-interpreter");
+    args.push_back("-fsyntax-only");
+    args.push_back(fileName);
+    clang::tooling::ToolInvocation invocation(args, std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction(entry)),
+                                              files.get());
+    return invocation.run();
+}
+
+unsigned BatchServer::runFiles(const std::vector<std::string> &files)
+{
+    typedef std::chrono::steady_clock Clock;
+    unsigned failed = 0;
+    Clock::time_point batchStart = Clock::now();
+    for (const std::string &file : files)
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> source = llvm::MemoryBuffer::getFile(file);
+        if (!source)
+        {
+            llvm::errs() << "\n[batch] " << file << " : cannot read : " << source.getError().message() << "\n";
+            ++failed;
+            continue;
+        }
+        Clock::time_point start = Clock::now();
+        bool ok = run(file, (*source)->getBuffer().str());
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        llvm::errs() << "\n[batch] " << file << " : " << (ok ? "ok" : "failed") << " " << llvm::format("%.3f ms", ms) << "\n";
+        if (!ok)
+            ++failed;
+    }
+    double total = std::chrono::duration<double, std::milli>(Clock::now() - batchStart).count();
+    llvm::errs() << "[batch] " << files.size() << " programs, " << failed << " failed, "
+                 << llvm::format("%.3f ms", total) << "\n";
+    return failed;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "clang/Basic/FileManager.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+/// Interprets many programs in one process.
+/// The process, LLVM and the JIT target are set up once; every program is
+/// parsed by a fresh CompilerInstance over an in-memory layer holding only
+/// its source and run with a fresh Environment / VM, so nothing leaks
+/// between programs or piles up over a long batch.
+class BatchServer
+{
+public:
+    BatchServer();
+    /// Parse and run one program, false if it did not compile
+    bool run(const std::string &name, const std::string &code);
+    /// Run every file in order and report per program status and timing on
+    /// stderr. Returns the number of programs that failed.
+    unsigned runFiles(const std::vector<std::string> &files);
+
+private:
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> mRealFiles;
+};
@@ -0,0 +1,25 @@
+#include "Bytecode.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+const char *opcodeName(Opcode op)
+{
+    static const char *names[] = {
+#define BYTECODE_NAME(name) #name,
+        BYTECODE_OPCODES(BYTECODE_NAME)
+#undef BYTECODE_NAME
+    };
+    return op < OP_COUNT ? names[op] : "???";
+}
+
+void dumpFunction(const CompiledFunction &fn)
+{
+    llvm::errs() << fn.name << " : params " << fn.numParams << ", regs " << fn.numRegs
+                 << ", frame bytes " << fn.frameBytes << "\n";
+    for (size_t pc = 0; pc < fn.code.size(); ++pc)
+    {
+        const Instr &instr = fn.code[pc];
+        llvm::errs() << "  " << pc << "\t" << opcodeName(instr.op) << "\t"
+                     << instr.a << ", " << instr.b << ", " << instr.c << "\n";
+    }
+}
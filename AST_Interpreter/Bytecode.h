@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Register based bytecode executed by the VM.
+/// Every operand is resolved when a function is lowered: registers are frame
+/// relative slot indices, globals are byte offsets into the static segment and
+/// callees are function indices, so a Program holds no pointer into the AST.
+///
+/// Operand naming used below : a is the destination (or the stored value /
+/// branch condition), b and c are sources.  "imm" means the operand itself
+/// is the value, "off" is a byte offset, "pc" an instruction index.
+#define BYTECODE_OPCODES(X)                                          \
+    X(NOP)                                                           \
+    X(MOV)      /* a <- b                                          */ \
+    X(LOADI)    /* a <- imm b (sign extended to 64 bit)            */ \
+    X(ADD_I)    /* int32 arithmetic : a <- b op c                  */ \
+    X(SUB_I)                                                         \
+    X(MUL_I)                                                         \
+    X(DIV_I)                                                         \
+    X(REM_I)                                                         \
+    X(NEG_I)    /* a <- -b                                         */ \
+    X(NOT_B)    /* a <- !b                                         */ \
+    X(NEZ_I)    /* a <- b != 0                                     */ \
+    X(NEZ_P)    /* a <- b != nullptr                               */ \
+    X(ADD_U)    /* uint64 arithmetic : a <- b op c                 */ \
+    X(SUB_U)                                                         \
+    X(MUL_U)                                                         \
+    X(DIV_U)                                                         \
+    X(EQ_I)     /* int32 comparison : a <- b op c                  */ \
+    X(NE_I)                                                          \
+    X(LT_I)                                                          \
+    X(GT_I)                                                          \
+    X(LE_I)                                                          \
+    X(GE_I)                                                          \
+    X(EQ_U)     /* uint64 / pointer comparison : a <- b op c       */ \
+    X(NE_U)                                                          \
+    X(LT_U)                                                          \
+    X(GT_U)                                                          \
+    X(LE_U)                                                          \
+    X(GE_U)                                                          \
+    X(I2U)      /* a <- (uint64) b                                 */ \
+    X(U2I)      /* a <- (int32) b                                  */ \
+    X(I2C)      /* a <- (int8) b                                   */ \
+    X(PADD)     /* a <- b + c * scale                              */ \
+    X(PSUB)     /* a <- b - c * scale                              */ \
+    X(LOAD8)    /* a <- *(int8 *) b                                */ \
+    X(LOAD32)   /* a <- *(int32 *) b                               */ \
+    X(LOAD64)   /* a <- *(uint64 *) b                              */ \
+    X(STORE8)   /* *(int8 *) b <- a                                */ \
+    X(STORE32)  /* *(int32 *) b <- a                               */ \
+    X(STORE64)  /* *(uint64 *) b <- a                              */ \
+    X(LOADG8)   /* a <- global at off b                            */ \
+    X(LOADG32)                                                       \
+    X(LOADG64)                                                       \
+    X(STOREG8)  /* global at off b <- a                            */ \
+    X(STOREG32)                                                      \
+    X(STOREG64)                                                      \
+    X(ADDRG)    /* a <- address of global at off b                 */ \
+    X(ADDRL)    /* a <- address of frame array storage at off b    */ \
+    X(JMP)      /* goto pc a                                       */ \
+    X(JT)       /* if (a) goto pc b                                */ \
+    X(JF)       /* if (!a) goto pc b                               */ \
+    X(CALL)     /* a <- function b (args in registers c ...)       */ \
+    X(TAILCALL) /* CALL whose result the next RET returns, the     */ \
+                /* callee may take over the caller's frame         */ \
+    X(RET)      /* return a                                        */ \
+    X(RETV)     /* return (void)                                   */ \
+    X(GET)      /* a <- GET()                                      */ \
+    X(PRINT)    /* PRINT(a)                                        */ \
+    X(MALLOC)   /* a <- MALLOC(b)                                  */ \
+    X(FREE)     /* FREE(a)                                         */ \
+    X(VLOOP)    /* run loops[a] with vector kernels, if it could   */ \
+                /* goto pc b, else fall into the scalar loop       */ \
+    /* superinstructions, one dispatch for a common source idiom   */ \
+    X(ADDK_I)   /* a <- b + imm c               i = i + 1          */ \
+    X(JEQ_I)    /* if (a op b) goto pc c        while (i < n)      */ \
+    X(JNE_I)                                                         \
+    X(JLT_I)                                                         \
+    X(JGT_I)                                                         \
+    X(JLE_I)                                                         \
+    X(JGE_I)                                                         \
+    X(JEQK_I)   /* if (a op imm b) goto pc c    if (x < 10)        */ \
+    X(JNEK_I)                                                        \
+    X(JLTK_I)                                                        \
+    X(JGTK_I)                                                        \
+    X(JLEK_I)                                                        \
+    X(JGEK_I)                                                        \
+    X(LOADX8)   /* a <- ((int8 *) b)[c]         x = a[i]           */ \
+    X(LOADX32)  /* a <- ((int32 *) b)[c]                           */ \
+    X(LOADX64)  /* a <- ((uint64 *) b)[c]                          */ \
+    X(STOREX8)  /* ((int8 *) b)[c] <- a         a[i] = x           */ \
+    X(STOREX32) /* ((int32 *) b)[c] <- a                           */ \
+    X(STOREX64) /* ((uint64 *) b)[c] <- a                          */
+
+enum Opcode : uint8_t
+{
+#define BYTECODE_ENUM(name) OP_##name,
+    BYTECODE_OPCODES(BYTECODE_ENUM)
+#undef BYTECODE_ENUM
+        OP_COUNT
+};
+
+const char *opcodeName(Opcode op);
+
+inline bool isSuperinstruction(Opcode op)
+{
+    return op >= OP_ADDK_I;
+}
+
+/// the fused compare and branch forms keep their target pc in c
+inline bool isCompareBranch(Opcode op)
+{
+    return op >= OP_JEQ_I && op <= OP_JGEK_I;
+}
+
+/// One VM register. The owning instruction decides which member is live,
+/// the lowering stage guarantees the reader agrees with the writer.
+union Slot
+{
+    int32_t i;
+    uint64_t u;
+    void *p;
+};
+
+struct Instr
+{
+    Opcode op;
+    /// element width in bytes for PADD / PSUB
+    uint8_t scale;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+/// Operand of a vectorized loop : the int array whose address is in
+/// register value, the int register value or the immediate value.
+struct VectorOperand
+{
+    enum Kind : uint8_t
+    {
+        ARRAY,
+        REG,
+        IMM
+    } kind;
+    int32_t value;
+};
+
+/// A counted loop over int arrays with no dependence between iterations,
+/// i being register counter and n the limit operand (REG or IMM):
+///   MAP : for (; i < n; i = i + 1) dst[i] = lhs op rhs
+///   SUM : for (; i < n; i = i + 1) dst = dst + lhs[i]
+/// For MAP dst holds the address of the destination array, for SUM it is
+/// the accumulator register and lhs the array summed.
+struct VectorLoop
+{
+    enum Kind : uint8_t
+    {
+        MAP,
+        SUM
+    } kind;
+    enum Op : uint8_t
+    {
+        ADD,
+        SUB,
+        MUL
+    } op;
+    int32_t counter;
+    int32_t dst;
+    VectorOperand limit;
+    VectorOperand lhs;
+    VectorOperand rhs;
+};
+
+struct CompiledFunction
+{
+    std::string name;
+    uint32_t numParams = 0;
+    /// parameters occupy registers [0, numParams), locals follow, temporaries last
+    uint32_t numRegs = 0;
+    /// bytes of local array storage addressed by ADDRL
+    uint32_t frameBytes = 0;
+    /// pure with int parameters and result, calls may be answered from a MemoTable
+    bool memoizable = false;
+    std::vector<Instr> code;
+    /// indexed by the a operand of VLOOP
+    std::vector<VectorLoop> loops;
+};
+
+struct Program
+{
+    std::vector<CompiledFunction> functions;
+    /// initial image of the static segment addressed by LOADG / STOREG / ADDRG
+    std::vector<char> globals;
+    int32_t entry = -1;
+};
+
+void dumpFunction(const CompiledFunction &fn);
@@ -0,0 +1,1100 @@
+#include "BytecodeCompiler.h"
+
+#include <climits>
+#include <utility>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "PurityAnalysis.h"
+
+BytecodeCompiler::BytecodeCompiler(ASTContext &context, bool vectorize)
+    : mContext(context), mProgram(nullptr), mFailed(false), mVectorize(vectorize),
+      mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL),
+      mFn(nullptr), mFirstTemp(0), mNextTemp(0)
+{
+}
+
+bool BytecodeCompiler::compile(TranslationUnitDecl *unit, Program &program)
+{
+    mProgram = &program;
+    mFailed = false;
+
+    // number every function first so calls to functions defined later resolve
+    std::vector<FunctionDecl *> definitions;
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
+    {
+        if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
+        {
+            FunctionDecl *canonical = fdecl->getCanonicalDecl();
+            if (fdecl->getName().equals("FREE"))
+                mFree = canonical;
+            else if (fdecl->getName().equals("MALLOC"))
+                mMalloc = canonical;
+            else if (fdecl->getName().equals("GET"))
+                mInput = canonical;
+            else if (fdecl->getName().equals("PRINT"))
+                mOutput = canonical;
+            else if (fdecl->isThisDeclarationADefinition())
+            {
+                int32_t index = program.functions.size();
+                mFunctionIndex[canonical] = index;
+                program.functions.push_back(CompiledFunction());
+                definitions.push_back(fdecl);
+                if (fdecl->getName().equals("main"))
+                    program.entry = index;
+            }
+        }
+        else if (VarDecl *varDecl = dyn_cast<VarDecl>(*i))
+        {
+            mGlobalOffset[varDecl] = allocGlobal(varDecl);
+        }
+        else if (isa<TypedefDecl>(*i))
+        {
+            // ignore typedef
+        }
+        else
+            unsupported(*i);
+    }
+
+    PurityAnalysis purity(unit);
+    for (size_t i = 0; i < definitions.size() && !mFailed; ++i)
+    {
+        compileFunction(definitions[i], program.functions[i]);
+        program.functions[i].memoizable = purity.isMemoizable(definitions[i]);
+    }
+
+    return !mFailed && program.entry >= 0;
+}
+
+BytecodeCompiler::ValType BytecodeCompiler::classify(QualType qualType)
+{
+    const Type *type = qualType.getCanonicalType().getTypePtr();
+    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
+    {
+        switch (builtinType->getKind())
+        {
+        case BuiltinType::Kind::Void:
+            return VT_VOID;
+        case BuiltinType::Kind::Bool:
+            return VT_BOOL;
+        case BuiltinType::Kind::Char_S:
+        case BuiltinType::Kind::Char_U:
+        case BuiltinType::Kind::SChar:
+            return VT_CHAR;
+        case BuiltinType::Kind::Int:
+            return VT_INT;
+        case BuiltinType::Kind::ULong:
+            return VT_ULONG;
+        default:
+            return VT_NONE;
+        }
+    }
+    if (type->isPointerType() && !type->isFunctionPointerType())
+        return VT_POINTER;
+    return VT_NONE;
+}
+
+int32_t BytecodeCompiler::widthOf(ValType type)
+{
+    switch (type)
+    {
+    case VT_BOOL:
+    case VT_CHAR:
+        return 1;
+    case VT_INT:
+        return 4;
+    case VT_ULONG:
+    case VT_POINTER:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t alignSlot(uint32_t offset)
+{
+    return (offset + 7) & ~7u;
+}
+
+uint32_t BytecodeCompiler::allocGlobal(VarDecl *varDecl)
+{
+    std::vector<char> &globals = mProgram->globals;
+    uint32_t offset = alignSlot(globals.size());
+
+    const Type *type = varDecl->getType().getTypePtr();
+    if (const ConstantArrayType *arrayType = dyn_cast<ConstantArrayType>(type))
+    {
+        int32_t width = widthOf(classify(arrayType->getElementType()));
+        if (width == 0 || varDecl->hasInit())
+            unsupported(varDecl);
+        globals.resize(offset + width * arrayType->getSize().getZExtValue());
+        return offset;
+    }
+
+    ValType valType = classify(varDecl->getType());
+    int32_t width = widthOf(valType);
+    if (width == 0)
+    {
+        unsupported(varDecl);
+        return offset;
+    }
+    globals.resize(offset + width);
+    if (varDecl->hasInit())
+    {
+        APValue *value = varDecl->evaluateValue();
+        if (value != nullptr && value->hasValue() && value->isInt())
+        {
+            int64_t val = value->getInt().getSExtValue();
+            memcpy(&globals[offset], &val, width); // little endian host
+        }
+        else
+            unsupported(varDecl);
+    }
+    return offset;
+}
+
+void BytecodeCompiler::unsupported(Stmt *stmt)
+{
+    mFailed = true;
+#ifdef DEBUG
+    llvm::errs() << "bytecode : unsupported " << stmt->getStmtClassName() << "\n";
+    stmt->dumpColor();
+#endif
+}
+
+void BytecodeCompiler::unsupported(Decl *decl)
+{
+    mFailed = true;
+#ifdef DEBUG
+    llvm::errs() << "bytecode : unsupported declaration\n";
+    decl->dumpColor();
+#endif
+}
+
+void BytecodeCompiler::compileFunction(FunctionDecl *fdecl, CompiledFunction &fn)
+{
+    mFn = &fn;
+    mLocalReg.clear();
+    mLocalArray.clear();
+
+    fn.name = fdecl->getNameAsString();
+    fn.numParams = fdecl->getNumParams();
+    for (unsigned i = 0; i < fn.numParams; ++i)
+    {
+        ParmVarDecl *param = fdecl->getParamDecl(i);
+        if (classify(param->getType()) == VT_NONE)
+            unsupported(param);
+        mLocalReg[param] = i;
+    }
+    fn.numRegs = fn.numParams;
+    collectLocals(fdecl->getBody());
+
+    mFirstTemp = mNextTemp = fn.numRegs;
+    compileStmt(fdecl->getBody());
+    emit(OP_RETV);
+    markTailCalls();
+#ifdef DEBUG
+    dumpFunction(fn);
+#endif
+}
+
+void BytecodeCompiler::markTailCalls()
+{
+    // a frame with local arrays must outlive the call, its arguments may point into them
+    if (mFn->frameBytes != 0)
+        return;
+    std::vector<Instr> &code = mFn->code;
+    for (size_t pc = 0; pc + 1 < code.size(); ++pc)
+    {
+        const Instr &next = code[pc + 1];
+        if (code[pc].op == OP_CALL &&
+            ((next.op == OP_RET && code[pc].a >= 0 && next.a == code[pc].a) || next.op == OP_RETV))
+            code[pc].op = OP_TAILCALL;
+    }
+}
+
+/// Give every local a register (or frame storage for arrays) up front, so
+/// temporaries can be reset after each statement without clobbering them.
+void BytecodeCompiler::collectLocals(Stmt *stmt)
+{
+    if (stmt == NULL)
+        return;
+    if (DeclStmt *declStmt = dyn_cast<DeclStmt>(stmt))
+    {
+        for (DeclStmt::decl_iterator it = declStmt->decl_begin(), ie = declStmt->decl_end(); it != ie; ++it)
+        {
+            VarDecl *vardecl = dyn_cast<VarDecl>(*it);
+            if (vardecl == NULL || vardecl->hasGlobalStorage())
+            {
+                unsupported(*it);
+                continue;
+            }
+            const Type *type = vardecl->getType().getTypePtr();
+            if (const ConstantArrayType *arrayType = dyn_cast<ConstantArrayType>(type))
+            {
+                int32_t width = widthOf(classify(arrayType->getElementType()));
+                if (width == 0)
+                    unsupported(vardecl);
+                mFn->frameBytes = alignSlot(mFn->frameBytes);
+                mLocalArray[vardecl] = mFn->frameBytes;
+                mFn->frameBytes += width * arrayType->getSize().getZExtValue();
+            }
+            else if (widthOf(classify(vardecl->getType())) > 0)
+                mLocalReg[vardecl] = mFn->numRegs++;
+            else
+                unsupported(vardecl);
+        }
+    }
+    for (Stmt *child : stmt->children())
+        collectLocals(child);
+}
+
+void BytecodeCompiler::compileStmt(Stmt *stmt)
+{
+    if (stmt == NULL)
+        return;
+
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt))
+    {
+        for (Stmt *child : compound->body())
+            compileStmt(child);
+    }
+    else if (DeclStmt *declStmt = dyn_cast<DeclStmt>(stmt))
+        compileDecl(declStmt);
+    else if (IfStmt *ifStmt = dyn_cast<IfStmt>(stmt))
+        compileIf(ifStmt);
+    else if (WhileStmt *whileStmt = dyn_cast<WhileStmt>(stmt))
+        compileWhile(whileStmt);
+    else if (ForStmt *forStmt = dyn_cast<ForStmt>(stmt))
+        compileFor(forStmt);
+    else if (ReturnStmt *returnStmt = dyn_cast<ReturnStmt>(stmt))
+        compileReturn(returnStmt);
+    else if (isa<BreakStmt>(stmt) || isa<ContinueStmt>(stmt))
+    {
+        // resolved once the loop knows where its exit and its next iteration start
+        if (mLoops.empty())
+            unsupported(stmt);
+        else if (isa<BreakStmt>(stmt))
+            mLoops.back().breaks.push_back(emit(OP_JMP));
+        else
+            mLoops.back().continues.push_back(emit(OP_JMP));
+    }
+    else if (isa<NullStmt>(stmt))
+    {
+        // nothing to do
+    }
+    else if (Expr *expr = dyn_cast<Expr>(stmt))
+        compileExpr(expr);
+    else
+        unsupported(stmt);
+
+    // temporaries never live across statements
+    mNextTemp = mFirstTemp;
+}
+
+void BytecodeCompiler::compileDecl(DeclStmt *declStmt)
+{
+    for (DeclStmt::decl_iterator it = declStmt->decl_begin(), ie = declStmt->decl_end(); it != ie; ++it)
+    {
+        VarDecl *vardecl = dyn_cast<VarDecl>(*it);
+        if (vardecl == NULL)
+            continue; // already reported by collectLocals
+
+        std::map<VarDecl *, int32_t>::iterator reg = mLocalReg.find(vardecl);
+        if (reg != mLocalReg.end())
+        {
+            if (vardecl->hasInit())
+                compileExpr(vardecl->getInit(), reg->second);
+            else
+                emit(OP_LOADI, reg->second, 0);
+        }
+        else if (vardecl->hasInit())
+        {
+            // initialized arrays are not lowered, the program runs on the walker
+            unsupported(declStmt);
+        }
+    }
+}
+
+void BytecodeCompiler::compileIf(IfStmt *ifStmt)
+{
+    size_t jumpElse = compileBranch(ifStmt->getCond(), false);
+    mNextTemp = mFirstTemp;
+
+    compileStmt(ifStmt->getThen());
+    if (Stmt *elseStmt = ifStmt->getElse())
+    {
+        size_t jumpEnd = emit(OP_JMP);
+        patch(jumpElse);
+        compileStmt(elseStmt);
+        patch(jumpEnd);
+    }
+    else
+        patch(jumpElse);
+}
+
+/// Loops are laid out body first with the condition at the bottom, so each
+/// iteration costs a single conditional branch.
+void BytecodeCompiler::compileWhile(WhileStmt *whileStmt)
+{
+    size_t jumpCond = emit(OP_JMP);
+    int32_t body = here();
+    mLoops.push_back(Loop());
+    compileStmt(whileStmt->getBody());
+
+    patch(jumpCond);
+    patchAll(mLoops.back().continues);
+    compileBranch(whileStmt->getCond(), true, body);
+    patchAll(mLoops.back().breaks);
+    mLoops.pop_back();
+}
+
+void BytecodeCompiler::compileFor(ForStmt *forStmt)
+{
+    compileStmt(forStmt->getInit());
+    // the scalar loop below only runs when the vector kernels decline
+    size_t vectorLoop;
+    bool vectorized = mVectorize && compileVectorLoop(forStmt, vectorLoop);
+    size_t jumpCond = emit(OP_JMP);
+    int32_t body = here();
+    mLoops.push_back(Loop());
+    compileStmt(forStmt->getBody());
+    patchAll(mLoops.back().continues);
+    if (Expr *inc = forStmt->getInc())
+    {
+        compileExpr(inc);
+        mNextTemp = mFirstTemp;
+    }
+
+    patch(jumpCond);
+    if (Expr *condExpr = forStmt->getCond())
+        compileBranch(condExpr, true, body);
+    else
+        emit(OP_JMP, body);
+    patchAll(mLoops.back().breaks);
+    if (vectorized)
+        patch(vectorLoop);
+    mLoops.pop_back();
+}
+
+bool BytecodeCompiler::compileVectorLoop(ForStmt *forStmt, size_t &pc)
+{
+    VectorLoop loop;
+    // i < n; i = i + 1
+    BinaryOperator *compare = forStmt->getCond() ? dyn_cast<BinaryOperator>(forStmt->getCond()->IgnoreParens()) : NULL;
+    if (compare == NULL || compare->getOpcode() != BinaryOperator::Opcode::BO_LT)
+        return false;
+    loop.counter = intRegisterOf(compare->getLHS());
+    if (loop.counter < 0 || !isIncrement(forStmt->getInc(), loop.counter) ||
+        !scalarOperand(compare->getRHS(), loop.counter, loop.limit))
+        return false;
+
+    // a single assignment
+    Stmt *body = forStmt->getBody();
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(body))
+    {
+        if (compound->size() != 1)
+            return false;
+        body = *compound->body_begin();
+    }
+    BinaryOperator *assign = dyn_cast<BinaryOperator>(body);
+    if (assign == NULL || assign->getOpcode() != BinaryOperator::Opcode::BO_Assign)
+        return false;
+
+    // array expressions of dst, lhs and rhs, evaluated once before the loop
+    Expr *bases[3] = {NULL, NULL, NULL};
+    Expr *value = assign->getRHS()->IgnoreParens();
+    BinaryOperator *arith = dyn_cast<BinaryOperator>(value);
+    if (arith != NULL && classify(arith->getType()) != VT_INT)
+        return false;
+    if (isCountedElement(assign->getLHS(), loop.counter, bases[0]))
+    {
+        // dst[i] = lhs op rhs, or dst[i] = lhs as dst[i] = lhs + 0
+        loop.kind = VectorLoop::MAP;
+        Expr *lhs = value;
+        Expr *rhs = NULL;
+        loop.op = VectorLoop::ADD;
+        loop.rhs = VectorOperand{VectorOperand::IMM, 0};
+        if (arith != NULL)
+        {
+            switch (arith->getOpcode())
+            {
+            case BinaryOperator::Opcode::BO_Add:
+                break;
+            case BinaryOperator::Opcode::BO_Sub:
+                loop.op = VectorLoop::SUB;
+                break;
+            case BinaryOperator::Opcode::BO_Mul:
+                loop.op = VectorLoop::MUL;
+                break;
+            default:
+                return false;
+            }
+            lhs = arith->getLHS();
+            rhs = arith->getRHS();
+        }
+        if (isCountedElement(lhs, loop.counter, bases[1]))
+            loop.lhs.kind = VectorOperand::ARRAY;
+        else if (!scalarOperand(lhs, loop.counter, loop.lhs))
+            return false;
+        if (rhs != NULL && isCountedElement(rhs, loop.counter, bases[2]))
+            loop.rhs.kind = VectorOperand::ARRAY;
+        else if (rhs != NULL && !scalarOperand(rhs, loop.counter, loop.rhs))
+            return false;
+    }
+    else
+    {
+        // s = s + a[i] or s = a[i] + s
+        loop.kind = VectorLoop::SUM;
+        loop.op = VectorLoop::ADD;
+        loop.dst = intRegisterOf(assign->getLHS());
+        if (loop.dst < 0 || loop.dst == loop.counter ||
+            (loop.limit.kind == VectorOperand::REG && loop.limit.value == loop.dst) ||
+            arith == NULL || arith->getOpcode() != BinaryOperator::Opcode::BO_Add)
+            return false;
+        Expr *element = intRegisterOf(arith->getLHS()) == loop.dst ? arith->getRHS() : arith->getLHS();
+        Expr *accumulator = element == arith->getRHS() ? arith->getLHS() : arith->getRHS();
+        if (intRegisterOf(accumulator) != loop.dst || !isCountedElement(element, loop.counter, bases[1]))
+            return false;
+        loop.lhs.kind = VectorOperand::ARRAY;
+        loop.rhs = VectorOperand{VectorOperand::IMM, 0};
+    }
+
+    if (bases[0] != NULL)
+        loop.dst = compileExpr(bases[0]);
+    if (bases[1] != NULL)
+        loop.lhs.value = compileExpr(bases[1]);
+    if (bases[2] != NULL)
+        loop.rhs.value = compileExpr(bases[2]);
+    pc = emit(OP_VLOOP, mFn->loops.size());
+    mFn->loops.push_back(loop);
+    mNextTemp = mFirstTemp;
+    return true;
+}
+
+bool BytecodeCompiler::isIncrement(Expr *inc, int32_t counter)
+{
+    if (inc == NULL)
+        return false;
+    inc = inc->IgnoreParens();
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(inc))
+        return (uop->getOpcode() == UnaryOperator::Opcode::UO_PreInc || uop->getOpcode() == UnaryOperator::Opcode::UO_PostInc) &&
+               intRegisterOf(uop->getSubExpr()) == counter;
+    BinaryOperator *assign = dyn_cast<BinaryOperator>(inc);
+    if (assign == NULL || assign->getOpcode() != BinaryOperator::Opcode::BO_Assign || intRegisterOf(assign->getLHS()) != counter)
+        return false;
+    BinaryOperator *add = dyn_cast<BinaryOperator>(assign->getRHS()->IgnoreParens());
+    int32_t one;
+    if (add == NULL || add->getOpcode() != BinaryOperator::Opcode::BO_Add)
+        return false;
+    return (intRegisterOf(add->getLHS()) == counter && immediateOf(add->getRHS(), one) && one == 1) ||
+           (intRegisterOf(add->getRHS()) == counter && immediateOf(add->getLHS(), one) && one == 1);
+}
+
+bool BytecodeCompiler::isCountedElement(Expr *expr, int32_t counter, Expr *&base)
+{
+    if (classify(expr->getType()) != VT_INT)
+        return false;
+    ArraySubscriptExpr *subscript = dyn_cast<ArraySubscriptExpr>(expr->IgnoreParenImpCasts());
+    if (subscript == NULL || classify(subscript->getType()) != VT_INT || intRegisterOf(subscript->getIdx()) != counter)
+        return false;
+    // a variable, so evaluating it once before the loop has no effect
+    if (!isa<DeclRefExpr>(subscript->getBase()->IgnoreParenImpCasts()))
+        return false;
+    base = subscript->getBase();
+    return true;
+}
+
+bool BytecodeCompiler::scalarOperand(Expr *expr, int32_t counter, VectorOperand &operand)
+{
+    int32_t reg = intRegisterOf(expr);
+    if (reg >= 0 && reg != counter)
+    {
+        operand = VectorOperand{VectorOperand::REG, reg};
+        return true;
+    }
+    int32_t val;
+    if (reg < 0 && immediateOf(expr, val))
+    {
+        operand = VectorOperand{VectorOperand::IMM, val};
+        return true;
+    }
+    return false;
+}
+
+int32_t BytecodeCompiler::intRegisterOf(Expr *expr)
+{
+    if (classify(expr->getType()) != VT_INT)
+        return -1;
+    DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts());
+    VarDecl *vardecl = declref ? dyn_cast<VarDecl>(declref->getDecl()) : NULL;
+    if (vardecl == NULL || classify(vardecl->getType()) != VT_INT)
+        return -1;
+    std::map<VarDecl *, int32_t>::iterator local = mLocalReg.find(vardecl);
+    return local != mLocalReg.end() ? local->second : -1;
+}
+
+void BytecodeCompiler::compileReturn(ReturnStmt *returnStmt)
+{
+    Expr *retValue = returnStmt->getRetValue();
+    if (retValue == NULL || classify(retValue->getType()) == VT_VOID)
+    {
+        if (retValue != NULL)
+            compileExpr(retValue);
+        emit(OP_RETV);
+    }
+    else
+        emit(OP_RET, compileExpr(retValue));
+}
+
+/// An int comparison feeding a branch becomes a single compare and branch
+/// instruction, against an immediate when one side is a constant, instead of
+/// materializing the bool in a register first.
+size_t BytecodeCompiler::compileBranch(Expr *cond, bool ifTrue, int32_t target)
+{
+    BinaryOperator *bop = dyn_cast<BinaryOperator>(cond->IgnoreParens());
+    if (bop == NULL || bop->getOpcode() < BinaryOperator::Opcode::BO_LT || bop->getOpcode() > BinaryOperator::Opcode::BO_NE ||
+        classify(bop->getLHS()->getType()) != VT_INT || classify(bop->getRHS()->getType()) != VT_INT)
+    {
+        int32_t reg = compileExpr(cond);
+        return emit(ifTrue ? OP_JT : OP_JF, reg, target);
+    }
+
+    // indexed by BO_LT .. BO_NE; swapped operands and negation map through
+    static const Opcode branches[] = {OP_JLT_I, OP_JGT_I, OP_JLE_I, OP_JGE_I, OP_JEQ_I, OP_JNE_I};
+    static const int swapped[] = {1, 0, 3, 2, 4, 5};
+    static const int negated[] = {3, 2, 1, 0, 5, 4};
+    int cc = bop->getOpcode() - BinaryOperator::Opcode::BO_LT;
+    if (!ifTrue)
+        cc = negated[cc];
+
+    Expr *lhs = bop->getLHS();
+    Expr *rhs = bop->getRHS();
+    int32_t imm;
+    if (immediateOf(lhs, imm) && !immediateOf(rhs, imm))
+    {
+        std::swap(lhs, rhs);
+        cc = swapped[cc];
+    }
+    if (immediateOf(rhs, imm))
+        return emit((Opcode)(branches[cc] + OP_JEQK_I - OP_JEQ_I), compileExpr(lhs), imm, target);
+    int32_t left = compileExpr(lhs);
+    int32_t right = compileExpr(rhs);
+    return emit(branches[cc], left, right, target);
+}
+
+int32_t BytecodeCompiler::compileExpr(Expr *expr, int32_t dst)
+{
+    if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr))
+    {
+        int64_t val = integer->getValue().getSExtValue();
+        if (val < INT32_MIN || val > INT32_MAX)
+            unsupported(expr);
+        int32_t t = target(dst);
+        emit(OP_LOADI, t, (int32_t)val);
+        return t;
+    }
+    if (CXXBoolLiteralExpr *boolean = dyn_cast<CXXBoolLiteralExpr>(expr))
+    {
+        int32_t t = target(dst);
+        emit(OP_LOADI, t, boolean->getValue() ? 1 : 0);
+        return t;
+    }
+    if (CharacterLiteral *character = dyn_cast<CharacterLiteral>(expr))
+    {
+        int32_t t = target(dst);
+        emit(OP_LOADI, t, (int8_t)character->getValue());
+        return t;
+    }
+    if (ParenExpr *parenExpr = dyn_cast<ParenExpr>(expr))
+        return compileExpr(parenExpr->getSubExpr(), dst);
+    if (CastExpr *castExpr = dyn_cast<CastExpr>(expr))
+        return compileCast(castExpr, dst);
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+        return compileBinop(bop, dst);
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+        return compileUnary(uop, dst);
+    if (CallExpr *call = dyn_cast<CallExpr>(expr))
+        return compileCall(call, dst);
+    if (UnaryExprOrTypeTraitExpr *traitExpr = dyn_cast<UnaryExprOrTypeTraitExpr>(expr))
+    {
+        if (traitExpr->getKind() != UnaryExprOrTypeTrait::UETT_SizeOf)
+            unsupported(expr);
+        int32_t t = target(dst);
+        emit(OP_LOADI, t, (int32_t)(mContext.getTypeSize(traitExpr->getTypeOfArgument()) / 8));
+        return t;
+    }
+
+    unsupported(expr);
+    return target(dst);
+}
+
+int32_t BytecodeCompiler::compileCast(CastExpr *castExpr, int32_t dst)
+{
+    Expr *sub = castExpr->getSubExpr();
+    switch (castExpr->getCastKind())
+    {
+    case CastKind::CK_LValueToRValue:
+    {
+        LValue lvalue = compileLValue(sub);
+        if (lvalue.kind == LValue::REG)
+            return moveTo(lvalue.index, dst);
+
+        static const Opcode globalLoads[] = {OP_NOP, OP_LOADG8, OP_NOP, OP_LOADG32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_LOADG64};
+        static const Opcode memoryLoads[] = {OP_NOP, OP_LOAD8, OP_NOP, OP_LOAD32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_LOAD64};
+        static const Opcode indexedLoads[] = {OP_NOP, OP_LOADX8, OP_NOP, OP_LOADX32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_LOADX64};
+        int32_t t = target(dst);
+        int32_t width = widthOf(lvalue.type);
+        if (width == 0)
+            unsupported(castExpr);
+        else if (lvalue.kind == LValue::GLOBAL)
+            emit(globalLoads[width], t, lvalue.index);
+        else if (lvalue.kind == LValue::INDEXED)
+            emit(indexedLoads[width], t, lvalue.index, lvalue.element);
+        else
+            emit(memoryLoads[width], t, lvalue.index);
+        return t;
+    }
+    case CastKind::CK_ArrayToPointerDecay:
+    {
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(sub->IgnoreParens()))
+        {
+            if (VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl()))
+            {
+                std::map<VarDecl *, int32_t>::iterator local = mLocalArray.find(vardecl);
+                if (local != mLocalArray.end())
+                {
+                    int32_t t = target(dst);
+                    emit(OP_ADDRL, t, local->second);
+                    return t;
+                }
+                std::map<VarDecl *, int32_t>::iterator global = mGlobalOffset.find(vardecl);
+                if (global != mGlobalOffset.end())
+                {
+                    int32_t t = target(dst);
+                    emit(OP_ADDRG, t, global->second);
+                    return t;
+                }
+            }
+        }
+        unsupported(castExpr);
+        return target(dst);
+    }
+    case CastKind::CK_IntegralCast:
+    {
+        ValType from = classify(sub->getType());
+        ValType to = classify(castExpr->getType());
+        int32_t src = compileExpr(sub);
+        if (from == VT_NONE || to == VT_NONE)
+        {
+            unsupported(castExpr);
+            return target(dst);
+        }
+        if (to == VT_ULONG && from != VT_ULONG)
+        {
+            int32_t t = target(dst);
+            emit(OP_I2U, t, src);
+            return t;
+        }
+        if (from == VT_ULONG && to != VT_ULONG)
+        {
+            int32_t t = target(dst);
+            emit(OP_U2I, t, src);
+            if (to == VT_CHAR)
+                emit(OP_I2C, t, t);
+            return t;
+        }
+        if (to == VT_CHAR && from != VT_CHAR)
+        {
+            int32_t t = target(dst);
+            emit(OP_I2C, t, src);
+            return t;
+        }
+        // bool and char registers already hold a sign extended int32
+        return moveTo(src, dst);
+    }
+    case CastKind::CK_IntegralToBoolean:
+    case CastKind::CK_PointerToBoolean:
+    {
+        bool wide = classify(sub->getType()) == VT_ULONG || classify(sub->getType()) == VT_POINTER;
+        int32_t src = compileExpr(sub);
+        int32_t t = target(dst);
+        emit(wide ? OP_NEZ_P : OP_NEZ_I, t, src);
+        return t;
+    }
+    case CastKind::CK_NullToPointer:
+    {
+        int32_t t = target(dst);
+        emit(OP_LOADI, t, 0);
+        return t;
+    }
+    case CastKind::CK_BitCast:
+    case CastKind::CK_NoOp:
+        return compileExpr(sub, dst);
+    case CastKind::CK_ToVoid:
+        compileExpr(sub);
+        return -1;
+    default:
+        unsupported(castExpr);
+        return target(dst);
+    }
+}
+
+int32_t BytecodeCompiler::compileBinop(BinaryOperator *bop, int32_t dst)
+{
+    BinaryOperator::Opcode opcode = bop->getOpcode();
+    if (opcode == BinaryOperator::Opcode::BO_Assign)
+        return compileAssign(bop, dst);
+    if (opcode == BinaryOperator::Opcode::BO_LAnd || opcode == BinaryOperator::Opcode::BO_LOr)
+        return compileLogical(bop, dst);
+    if (opcode == BinaryOperator::Opcode::BO_Comma)
+    {
+        compileExpr(bop->getLHS());
+        return compileExpr(bop->getRHS(), dst);
+    }
+
+    ValType lhsType = classify(bop->getLHS()->getType());
+    ValType rhsType = classify(bop->getRHS()->getType());
+    ValType resultType = classify(bop->getType());
+    Opcode op = OP_NOP;
+    int32_t scale = 0;
+
+    if (bop->isComparisonOp())
+    {
+        bool wide = lhsType == VT_ULONG || lhsType == VT_POINTER;
+        switch (opcode)
+        {
+        case BinaryOperator::Opcode::BO_EQ:
+            op = wide ? OP_EQ_U : OP_EQ_I;
+            break;
+        case BinaryOperator::Opcode::BO_NE:
+            op = wide ? OP_NE_U : OP_NE_I;
+            break;
+        case BinaryOperator::Opcode::BO_LT:
+            op = wide ? OP_LT_U : OP_LT_I;
+            break;
+        case BinaryOperator::Opcode::BO_GT:
+            op = wide ? OP_GT_U : OP_GT_I;
+            break;
+        case BinaryOperator::Opcode::BO_LE:
+            op = wide ? OP_LE_U : OP_LE_I;
+            break;
+        case BinaryOperator::Opcode::BO_GE:
+            op = wide ? OP_GE_U : OP_GE_I;
+            break;
+        default:
+            break;
+        }
+    }
+    else if (resultType == VT_POINTER && lhsType == VT_POINTER && rhsType != VT_POINTER)
+    {
+        // pointer +/- integer
+        scale = widthOf(classify(bop->getLHS()->getType()->getPointeeType()));
+        if (opcode == BinaryOperator::Opcode::BO_Add)
+            op = OP_PADD;
+        else if (opcode == BinaryOperator::Opcode::BO_Sub)
+            op = OP_PSUB;
+    }
+    else if (resultType == VT_INT)
+    {
+        switch (opcode)
+        {
+        case BinaryOperator::Opcode::BO_Add:
+            op = OP_ADD_I;
+            break;
+        case BinaryOperator::Opcode::BO_Sub:
+            op = OP_SUB_I;
+            break;
+        case BinaryOperator::Opcode::BO_Mul:
+            op = OP_MUL_I;
+            break;
+        case BinaryOperator::Opcode::BO_Div:
+            op = OP_DIV_I;
+            break;
+        case BinaryOperator::Opcode::BO_Rem:
+            op = OP_REM_I;
+            break;
+        default:
+            break;
+        }
+    }
+    else if (resultType == VT_ULONG)
+    {
+        switch (opcode)
+        {
+        case BinaryOperator::Opcode::BO_Add:
+            op = OP_ADD_U;
+            break;
+        case BinaryOperator::Opcode::BO_Sub:
+            op = OP_SUB_U;
+            break;
+        case BinaryOperator::Opcode::BO_Mul:
+            op = OP_MUL_U;
+            break;
+        case BinaryOperator::Opcode::BO_Div:
+            op = OP_DIV_U;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (op == OP_NOP || ((op == OP_PADD || op == OP_PSUB) && (scale == 0 || rhsType == VT_NONE)))
+    {
+        unsupported(bop);
+        return target(dst);
+    }
+
+    // i + 1, i - 1 and 1 + i add an immediate
+    int32_t imm;
+    if ((op == OP_ADD_I || op == OP_SUB_I) && immediateOf(bop->getRHS(), imm) && (op == OP_ADD_I || imm != INT32_MIN))
+    {
+        int32_t lhs = compileExpr(bop->getLHS());
+        int32_t t = target(dst);
+        emit(OP_ADDK_I, t, lhs, op == OP_ADD_I ? imm : -imm);
+        return t;
+    }
+    if (op == OP_ADD_I && immediateOf(bop->getLHS(), imm))
+    {
+        int32_t rhs = compileExpr(bop->getRHS());
+        int32_t t = target(dst);
+        emit(OP_ADDK_I, t, rhs, imm);
+        return t;
+    }
+
+    int32_t lhs = compileExpr(bop->getLHS());
+    int32_t rhs = compileExpr(bop->getRHS());
+    int32_t t = target(dst);
+    if (scale != 0 && rhsType == VT_ULONG)
+    {
+        // p + sizeof(...) style offsets, PADD takes an int32 index
+        emit(OP_U2I, t, rhs);
+        rhs = t;
+    }
+    size_t pc = emit(op, t, lhs, rhs);
+    mFn->code[pc].scale = scale;
+    return t;
+}
+
+int32_t BytecodeCompiler::compileAssign(BinaryOperator *bop, int32_t dst)
+{
+    LValue lvalue = compileLValue(bop->getLHS());
+    if (lvalue.kind == LValue::REG)
+    {
+        compileExpr(bop->getRHS(), lvalue.index);
+        return moveTo(lvalue.index, dst);
+    }
+
+    static const Opcode globalStores[] = {OP_NOP, OP_STOREG8, OP_NOP, OP_STOREG32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_STOREG64};
+    static const Opcode memoryStores[] = {OP_NOP, OP_STORE8, OP_NOP, OP_STORE32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_STORE64};
+    static const Opcode indexedStores[] = {OP_NOP, OP_STOREX8, OP_NOP, OP_STOREX32, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_STOREX64};
+    int32_t width = widthOf(lvalue.type);
+    if (lvalue.kind == LValue::INDEXED && width != 0 && bop->getRHS()->HasSideEffects(mContext))
+    {
+        // base and index may be registers of locals the right side assigns,
+        // keep computing the address before it
+        int32_t addr = newTemp();
+        size_t pc = emit(OP_PADD, addr, lvalue.index, lvalue.element);
+        mFn->code[pc].scale = width;
+        lvalue = LValue{LValue::MEMORY, addr, lvalue.type};
+    }
+    // in x = a[x] = v the value must not overwrite the index before the store
+    bool clobbers = lvalue.kind == LValue::INDEXED && dst >= 0 && (dst == lvalue.index || dst == lvalue.element);
+    int32_t val = compileExpr(bop->getRHS(), clobbers ? -1 : dst);
+    if (width == 0)
+        unsupported(bop);
+    else if (lvalue.kind == LValue::GLOBAL)
+        emit(globalStores[width], val, lvalue.index);
+    else if (lvalue.kind == LValue::INDEXED)
+        emit(indexedStores[width], val, lvalue.index, lvalue.element);
+    else
+        emit(memoryStores[width], val, lvalue.index);
+    return moveTo(val, dst);
+}
+
+int32_t BytecodeCompiler::compileLogical(BinaryOperator *bop, int32_t dst)
+{
+    // evaluate into a fresh temporary, dst may be read by the right operand
+    int32_t t = newTemp();
+    compileExpr(bop->getLHS(), t);
+    size_t jump = emit(bop->getOpcode() == BinaryOperator::Opcode::BO_LAnd ? OP_JF : OP_JT, t);
+    compileExpr(bop->getRHS(), t);
+    patch(jump);
+    return moveTo(t, dst);
+}
+
+int32_t BytecodeCompiler::compileUnary(UnaryOperator *uop, int32_t dst)
+{
+    switch (uop->getOpcode())
+    {
+    case UnaryOperator::Opcode::UO_Plus:
+        return compileExpr(uop->getSubExpr(), dst);
+    case UnaryOperator::Opcode::UO_Minus:
+    case UnaryOperator::Opcode::UO_LNot:
+    {
+        if (classify(uop->getType()) != (uop->getOpcode() == UnaryOperator::Opcode::UO_Minus ? VT_INT : VT_BOOL))
+            break;
+        int32_t src = compileExpr(uop->getSubExpr());
+        int32_t t = target(dst);
+        emit(uop->getOpcode() == UnaryOperator::Opcode::UO_Minus ? OP_NEG_I : OP_NOT_B, t, src);
+        return t;
+    }
+    default:
+        break;
+    }
+    unsupported(uop);
+    return target(dst);
+}
+
+int32_t BytecodeCompiler::compileCall(CallExpr *call, int32_t dst)
+{
+    FunctionDecl *callee = call->getDirectCallee();
+    if (callee == NULL)
+    {
+        unsupported(call);
+        return target(dst);
+    }
+    callee = callee->getCanonicalDecl();
+
+    if (callee == mInput)
+    {
+        int32_t t = target(dst);
+        emit(OP_GET, t);
+        return t;
+    }
+    if (callee == mOutput)
+    {
+        emit(OP_PRINT, compileExpr(call->getArg(0)));
+        return -1;
+    }
+    if (callee == mMalloc)
+    {
+        int32_t size = compileExpr(call->getArg(0));
+        int32_t t = target(dst);
+        emit(OP_MALLOC, t, size);
+        return t;
+    }
+    if (callee == mFree)
+    {
+        emit(OP_FREE, compileExpr(call->getArg(0)));
+        return -1;
+    }
+
+    std::map<FunctionDecl *, int32_t>::iterator function = mFunctionIndex.find(callee);
+    if (function == mFunctionIndex.end())
+    {
+        unsupported(call);
+        return target(dst);
+    }
+
+    // arguments go to consecutive registers, reserved before evaluating any of them
+    unsigned numArgs = call->getNumArgs();
+    int32_t argBase = mNextTemp;
+    for (unsigned i = 0; i < numArgs; ++i)
+        newTemp();
+    for (unsigned i = 0; i < numArgs; ++i)
+        compileExpr(call->getArg(i), argBase + i);
+
+    int32_t t = classify(call->getType()) == VT_VOID ? -1 : target(dst);
+    emit(OP_CALL, t, function->second, argBase);
+    return t;
+}
+
+BytecodeCompiler::LValue BytecodeCompiler::compileLValue(Expr *expr)
+{
+    expr = expr->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr))
+    {
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(declref->getDecl()))
+        {
+            ValType type = classify(vardecl->getType());
+            std::map<VarDecl *, int32_t>::iterator local = mLocalReg.find(vardecl);
+            if (local != mLocalReg.end())
+                return LValue{LValue::REG, local->second, type};
+            std::map<VarDecl *, int32_t>::iterator global = mGlobalOffset.find(vardecl);
+            if (global != mGlobalOffset.end())
+                return LValue{LValue::GLOBAL, global->second, type};
+        }
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+    {
+        if (uop->getOpcode() == UnaryOperator::Opcode::UO_Deref)
+            return LValue{LValue::MEMORY, compileExpr(uop->getSubExpr()), classify(uop->getType())};
+    }
+    else if (ArraySubscriptExpr *subscript = dyn_cast<ArraySubscriptExpr>(expr))
+    {
+        // the access itself scales the index, see LOADX / STOREX
+        ValType elemType = classify(subscript->getType());
+        int32_t base = compileExpr(subscript->getBase());
+        int32_t index = compileExpr(subscript->getIdx());
+        if (classify(subscript->getIdx()->getType()) == VT_ULONG)
+        {
+            int32_t narrowed = newTemp();
+            emit(OP_U2I, narrowed, index);
+            index = narrowed;
+        }
+        return LValue{LValue::INDEXED, base, elemType, index};
+    }
+
+    unsupported(expr);
+    return LValue{LValue::REG, newTemp(), VT_INT};
+}
+
+bool BytecodeCompiler::immediateOf(Expr *expr, int32_t &val)
+{
+    if (classify(expr->getType()) != VT_INT)
+        return false;
+    IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr->IgnoreParenImpCasts());
+    if (integer == NULL || classify(integer->getType()) != VT_INT)
+        return false;
+    int64_t value = integer->getValue().getSExtValue();
+    if (value < INT32_MIN || value > INT32_MAX)
+        return false;
+    val = (int32_t)value;
+    return true;
+}
+
+int32_t BytecodeCompiler::newTemp()
+{
+    int32_t reg = mNextTemp++;
+    if ((uint32_t)mNextTemp > mFn->numRegs)
+        mFn->numRegs = mNextTemp;
+    return reg;
+}
+
+int32_t BytecodeCompiler::moveTo(int32_t src, int32_t dst)
+{
+    if (dst < 0 || dst == src)
+        return src;
+    emit(OP_MOV, dst, src);
+    return dst;
+}
+
+size_t BytecodeCompiler::emit(Opcode op, int32_t a, int32_t b, int32_t c)
+{
+    Instr instr;
+    instr.op = op;
+    instr.scale = 0;
+    instr.a = a;
+    instr.b = b;
+    instr.c = c;
+    mFn->code.push_back(instr);
+    return mFn->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(size_t pc)
+{
+    Instr &instr = mFn->code[pc];
+    if (instr.op == OP_JMP)
+        instr.a = here();
+    else if (isCompareBranch(instr.op))
+        instr.c = here();
+    else
+        instr.b = here();
+}
+
+void BytecodeCompiler::patchAll(const std::vector<size_t> &pcs)
+{
+    for (size_t pc : pcs)
+        patch(pc);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstring>
+#include <map>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/ExprCXX.h"
+
+using namespace clang;
+
+#include "Bytecode.h"
+
+/// Lowers every FunctionDecl of a translation unit into bytecode once, so the
+/// VM never has to look at the AST (or dyn_cast a type) while running.
+class BytecodeCompiler
+{
+public:
+    /// vectorize : run simple counted array loops with vector kernels (VLOOP)
+    explicit BytecodeCompiler(ASTContext &context, bool vectorize = true);
+
+    /// Returns false if the unit uses a construct the lowering does not
+    /// handle; the caller is expected to fall back to the AST walker then.
+    bool compile(TranslationUnitDecl *unit, Program &program);
+
+private:
+    enum ValType
+    {
+        VT_NONE, /// not representable in a register
+        VT_VOID,
+        VT_BOOL,
+        VT_CHAR,
+        VT_INT,
+        VT_ULONG,
+        VT_POINTER
+    };
+
+    /// Where an lvalue lives : a register, a static segment offset, the
+    /// address held in a register or element `element` of the array whose
+    /// address is held in register index.
+    struct LValue
+    {
+        enum Kind
+        {
+            REG,
+            GLOBAL,
+            MEMORY,
+            INDEXED
+        } kind;
+        int32_t index;
+        ValType type;
+        int32_t element;
+    };
+
+    ASTContext &mContext;
+    Program *mProgram;
+    bool mFailed;
+    bool mVectorize;
+
+    FunctionDecl *mFree; /// Declartions to the built-in functions
+    FunctionDecl *mMalloc;
+    FunctionDecl *mInput;
+    FunctionDecl *mOutput;
+
+    std::map<FunctionDecl *, int32_t> mFunctionIndex;
+    std::map<VarDecl *, int32_t> mGlobalOffset;
+
+    // state of the function being lowered
+    CompiledFunction *mFn;
+    std::map<VarDecl *, int32_t> mLocalReg;
+    std::map<VarDecl *, int32_t> mLocalArray;
+    int32_t mFirstTemp;
+    int32_t mNextTemp;
+    /// branches of break / continue waiting for their loop's targets
+    struct Loop
+    {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+    std::vector<Loop> mLoops;
+
+    ValType classify(QualType type);
+    static int32_t widthOf(ValType type);
+    uint32_t allocGlobal(VarDecl *varDecl);
+    void unsupported(Stmt *stmt);
+    void unsupported(Decl *decl);
+
+    void compileFunction(FunctionDecl *fdecl, CompiledFunction &fn);
+    /// turn CALL directly followed by the RET of its result into TAILCALL
+    void markTailCalls();
+    void collectLocals(Stmt *stmt);
+    void compileStmt(Stmt *stmt);
+    void compileDecl(DeclStmt *declStmt);
+    void compileIf(IfStmt *ifStmt);
+    void compileWhile(WhileStmt *whileStmt);
+    void compileFor(ForStmt *forStmt);
+    void compileReturn(ReturnStmt *returnStmt);
+    /// Branch to target when cond evaluates to ifTrue, returns the branch pc
+    size_t compileBranch(Expr *cond, bool ifTrue, int32_t target = 0);
+    /// Emits the VLOOP in front of a for loop of VectorLoop shape, pc is
+    /// the VLOOP whose target is the loop's exit
+    bool compileVectorLoop(ForStmt *forStmt, size_t &pc);
+    /// counter = counter + 1, counter++ or ++counter
+    bool isIncrement(Expr *inc, int32_t counter);
+    /// expr is array[counter] of an int array, base is the array expression
+    bool isCountedElement(Expr *expr, int32_t counter, Expr *&base);
+    /// expr is an int register other than counter, or an int immediate
+    bool scalarOperand(Expr *expr, int32_t counter, VectorOperand &operand);
+    /// the register of the local int variable expr reads, -1 otherwise
+    int32_t intRegisterOf(Expr *expr);
+
+    /// Evaluates expr and returns the register holding its value. If dst is
+    /// not negative the value is produced in dst.
+    int32_t compileExpr(Expr *expr, int32_t dst = -1);
+    int32_t compileCast(CastExpr *castExpr, int32_t dst);
+    int32_t compileBinop(BinaryOperator *bop, int32_t dst);
+    int32_t compileUnary(UnaryOperator *uop, int32_t dst);
+    int32_t compileCall(CallExpr *call, int32_t dst);
+    int32_t compileAssign(BinaryOperator *bop, int32_t dst);
+    int32_t compileLogical(BinaryOperator *bop, int32_t dst);
+    LValue compileLValue(Expr *expr);
+    /// true if expr is an int constant that fits an instruction operand
+    bool immediateOf(Expr *expr, int32_t &val);
+
+    int32_t newTemp();
+    int32_t target(int32_t dst) { return dst >= 0 ? dst : newTemp(); }
+    int32_t moveTo(int32_t src, int32_t dst);
+    size_t emit(Opcode op, int32_t a = 0, int32_t b = 0, int32_t c = 0);
+    size_t here() const { return mFn->code.size(); }
+    /// point the branch emitted at pc to the next emitted instruction
+    void patch(size_t pc);
+    void patchAll(const std::vector<size_t> &pcs);
+};
@@ -0,0 +1,172 @@
+#include "ConstantFolder.h"
+
+#include "clang/AST/ExprCXX.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/Support/raw_ostream.h"
+
+// #define DEBUG
+
+void ConstantFolder::run(TranslationUnitDecl *unit)
+{
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
+    {
+        FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+        if (fdecl == NULL || !fdecl->isThisDeclarationADefinition())
+            continue;
+        Stmt *body = fdecl->getBody();
+        fold(body);
+        fdecl->setBody(body);
+    }
+#ifdef DEBUG
+    llvm::errs() << "fold : " << mStats.folded << " constants, " << mStats.branches << " dead branches, "
+                 << mStats.removed << " parens / no-op casts, " << mStats.identities << " identities\n";
+#endif
+}
+
+void ConstantFolder::fold(Stmt *&stmt)
+{
+    if (stmt == NULL)
+        return;
+
+    if (DeclStmt *declStmt = dyn_cast<DeclStmt>(stmt))
+    {
+        for (DeclStmt::decl_iterator it = declStmt->decl_begin(), ie = declStmt->decl_end(); it != ie; ++it)
+        {
+            VarDecl *vardecl = dyn_cast<VarDecl>(*it);
+            if (vardecl == NULL || !vardecl->hasInit())
+                continue;
+            Stmt *init = vardecl->getInit();
+            fold(init);
+            vardecl->setInit(cast<Expr>(init));
+        }
+        return;
+    }
+    // the operand of sizeof is never evaluated, only the node itself folds
+    if (!isa<UnaryExprOrTypeTraitExpr>(stmt))
+    {
+        for (Stmt *&child : stmt->children())
+            fold(child);
+    }
+
+    if (Expr *expr = dyn_cast<Expr>(stmt))
+        stmt = simplify(expr);
+    else if (IfStmt *ifStmt = dyn_cast<IfStmt>(stmt))
+        stmt = pruneIf(ifStmt);
+    else if (WhileStmt *whileStmt = dyn_cast<WhileStmt>(stmt))
+        stmt = pruneWhile(whileStmt);
+}
+
+/// Children are already simplified when a node gets here.
+Expr *ConstantFolder::simplify(Expr *expr)
+{
+    if (ParenExpr *parenExpr = dyn_cast<ParenExpr>(expr))
+    {
+        ++mStats.removed;
+        return parenExpr->getSubExpr();
+    }
+    if (ImplicitCastExpr *castExpr = dyn_cast<ImplicitCastExpr>(expr))
+    {
+        if (castExpr->getCastKind() == CastKind::CK_NoOp && castExpr->getSubExpr()->isRValue() == castExpr->isRValue())
+        {
+            ++mStats.removed;
+            return castExpr->getSubExpr();
+        }
+    }
+
+    if (isa<IntegerLiteral>(expr) || isa<CXXBoolLiteralExpr>(expr) || !expr->isRValue() ||
+        !expr->getType()->isIntegerType())
+        return expr;
+
+    Expr::EvalResult result;
+    if (expr->EvaluateAsInt(result, mContext) && !result.HasUndefinedBehavior)
+    {
+        ++mStats.folded;
+        return literal(expr->getType(), result.Val.getInt(), expr->getBeginLoc());
+    }
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+        return simplifyIdentity(bop);
+    return expr;
+}
+
+Expr *ConstantFolder::simplifyIdentity(BinaryOperator *bop)
+{
+    Expr *lhs = bop->getLHS();
+    Expr *rhs = bop->getRHS();
+    int64_t val;
+    Expr *kept = NULL;
+    switch (bop->getOpcode())
+    {
+    case BinaryOperator::Opcode::BO_Mul:
+        if (constantOf(rhs, val) && (val == 0 || val == 1))
+            kept = val == 1 ? lhs : (lhs->HasSideEffects(mContext) ? NULL : rhs);
+        else if (constantOf(lhs, val) && (val == 0 || val == 1))
+            kept = val == 1 ? rhs : (rhs->HasSideEffects(mContext) ? NULL : lhs);
+        break;
+    case BinaryOperator::Opcode::BO_Add:
+        if (constantOf(rhs, val) && val == 0)
+            kept = lhs;
+        else if (constantOf(lhs, val) && val == 0)
+            kept = rhs;
+        break;
+    case BinaryOperator::Opcode::BO_Sub:
+        if (constantOf(rhs, val) && val == 0)
+            kept = lhs;
+        break;
+    case BinaryOperator::Opcode::BO_Div:
+        if (constantOf(rhs, val) && val == 1)
+            kept = lhs;
+        break;
+    default:
+        break;
+    }
+    // the kept operand must already have the type of the whole expression
+    if (kept == NULL || !kept->isRValue() || !mContext.hasSameType(kept->getType(), bop->getType()))
+        return bop;
+    ++mStats.identities;
+    return kept;
+}
+
+Stmt *ConstantFolder::pruneIf(IfStmt *ifStmt)
+{
+    int64_t val;
+    if (ifStmt->getInit() != NULL || ifStmt->getConditionVariable() != NULL || !constantOf(ifStmt->getCond(), val))
+        return ifStmt;
+    ++mStats.branches;
+    Stmt *taken = val ? ifStmt->getThen() : ifStmt->getElse();
+    if (taken == NULL)
+        return new (mContext) NullStmt(ifStmt->getBeginLoc());
+    return taken;
+}
+
+Stmt *ConstantFolder::pruneWhile(WhileStmt *whileStmt)
+{
+    int64_t val;
+    if (whileStmt->getConditionVariable() != NULL || !constantOf(whileStmt->getCond(), val) || val != 0)
+        return whileStmt;
+    ++mStats.branches;
+    return new (mContext) NullStmt(whileStmt->getBeginLoc());
+}
+
+Expr *ConstantFolder::literal(QualType type, const llvm::APSInt &value, SourceLocation loc)
+{
+    if (type->isBooleanType())
+        return new (mContext) CXXBoolLiteralExpr(value.getBoolValue(), mContext.BoolTy, loc);
+    return IntegerLiteral::Create(mContext, value, type, loc);
+}
+
+bool ConstantFolder::constantOf(Expr *expr, int64_t &val)
+{
+    // a folded condition may still sit under its IntegralToBoolean cast
+    expr = expr->IgnoreParenImpCasts();
+    if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr))
+    {
+        val = integer->getValue().getSExtValue();
+        return true;
+    }
+    if (CXXBoolLiteralExpr *boolean = dyn_cast<CXXBoolLiteralExpr>(expr))
+    {
+        val = boolean->getValue();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+
+using namespace clang;
+
+/// Rewrites every function body of a translation unit in place, after
+/// parsing and before either engine sees it:
+///  - constant integer / bool subexpressions become a single literal
+///  - if (constant) and while (false) keep only the branch that can run
+///  - ParenExpr and no-op casts are dropped
+///  - x * 1, x + 0, x - 0, x / 1 become x and x * 0 becomes 0
+/// Global initializers are left to VarDecl::evaluateValue.
+class ConstantFolder
+{
+public:
+    struct Stats
+    {
+        unsigned folded = 0;
+        unsigned branches = 0;
+        unsigned removed = 0;
+        unsigned identities = 0;
+    };
+
+    explicit ConstantFolder(ASTContext &context) : mContext(context) {}
+    void run(TranslationUnitDecl *unit);
+    const Stats &stats() const
+    {
+        return mStats;
+    }
+
+private:
+    ASTContext &mContext;
+    Stats mStats;
+
+    /// rewrites the subtree rooted at stmt, stmt may be replaced
+    void fold(Stmt *&stmt);
+    Expr *simplify(Expr *expr);
+    Expr *simplifyIdentity(BinaryOperator *bop);
+    Stmt *pruneIf(IfStmt *ifStmt);
+    Stmt *pruneWhile(WhileStmt *whileStmt);
+    Expr *literal(QualType type, const llvm::APSInt &value, SourceLocation loc);
+    /// true if expr is a literal, its value in val
+    static bool constantOf(Expr *expr, int64_t &val);
+};
@@ -1,19 +1,48 @@
 #include "Environment.h"
 
 #include "ASTInterpreter.h"
+#include "PurityAnalysis.h"
 
-Environment::Environment() : mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL)
+#include <algorithm>
+
+#include "llvm/Support/Format.h"
+
+Environment::Environment() : mFlow(FLOW_NORMAL), mTailCallee(NULL), mIO(NULL), mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL),
+                             mMemoize(false), mMemoStats(false), mHeapBytes((size_t)4 << 30), mHeapStats(false), mSampleInterval(1000), mPerfCounters(false), mMemStats(false)
 {
 }
-FunctionDecl *Environment::getMainEntry()
+void Environment::setHeap(size_t reserveBytes, bool reportStats)
 {
-    return mEntry;
+    mHeapBytes = reserveBytes;
+    mHeapStats = reportStats;
+}
+void Environment::setProfile(const std::string &prefix)
+{
+    mProfilePrefix = prefix;
+}
+void Environment::setSampling(const std::string &prefix, unsigned intervalMicros)
+{
+    mSamplePrefix = prefix;
+    mSampleInterval = intervalMicros;
 }
-bool Environment::hasReturn()
+void Environment::setPerfCounters(bool enabled)
 {
-    return mStack.back().hasReturn();
+    mPerfCounters = enabled;
 }
-Object *Environment::searchDeclVal(Decl *decl)
+void Environment::setMemStats(bool enabled)
+{
+    mMemStats = enabled;
+}
+void Environment::setMemoization(bool enabled, bool reportStats)
+{
+    mMemoize = enabled;
+    mMemoStats = reportStats;
+}
+FunctionDecl *Environment::getMainEntry()
+{
+    return mEntry;
+}
+Value *Environment::searchDeclVal(Decl *decl)
 {
     if (this->mStack.back().hasDeclVal(decl))
     {
@@ -28,38 +57,48 @@ Object *Environment::searchDeclVal(Decl *decl)
         assert(0);
     }
 }
-void Environment::bindDeclToStack(Decl *decl, Object *val)
+void Environment::bindDeclToStack(Decl *decl, const Value &val)
 {
     mStack.back().bindDecl(decl, val);
 }
 
-void Environment::bindDeclToStatic(Decl *decl, Object *val)
+void Environment::bindDeclToStatic(Decl *decl, const Value &val)
 {
     mStatic.bindDecl(decl, val);
 }
-Object *Environment::getStmtVal(Stmt *stmt)
+const Value &Environment::getStmtVal(Stmt *stmt)
 {
-    if (this->hasStmtVal(stmt))
-    {
-        return this->mStack.back().getStmtVal(stmt);
-    }
-    else
-    {
-        assert(0);
-    }
+    return this->mStack.back().getStmtVal(stmt);
 }
 bool Environment::hasStmtVal(Stmt *stmt)
 {
     return mStack.back().hasStmtVal(stmt);
 }
-void Environment::bindStmtToStack(Stmt *stmt, Object *val)
+void Environment::bindStmtToStack(Stmt *stmt, const Value &val)
 {
     mStack.back().bindStmt(stmt, val);
 }
 
+const FunctionLayout *Environment::getLayout(FunctionDecl *fdecl)
+{
+    std::unique_ptr<FunctionLayout> &layout = mLayouts[fdecl->getCanonicalDecl()];
+    if (!layout)
+        layout.reset(new FunctionLayout(fdecl->getDefinition(), mStatic));
+    return layout.get();
+}
+
 void Environment::startNewFrame(FunctionDecl *entry, Expr **args = nullptr)
 {
-    mStack.push_back(StackFrame());
+    // the body refers to the parameters of the definition, not of the callee's redeclaration
+    entry = entry->getDefinition();
+    assert(entry != NULL);
+    mStack.push_back(StackFrame(getLayout(entry), mArena));
+    ++mMemCounters.framesCreated;
+    mMemCounters.maxDepth = std::max(mMemCounters.maxDepth, mStack.size());
+    if (mProfiler)
+        mProfiler->enterFunction(entry, true);
+    if (mPerf)
+        mPerf->enterFunction(entry);
 
     for (FunctionDecl::param_iterator pi = entry->param_begin(); pi != entry->param_end(); ++pi)
     {
@@ -71,16 +110,16 @@ void Environment::startNewFrame(FunctionDecl *entry, Expr **args = nullptr)
             {
                 if (builtinType->getKind() == BuiltinType::Kind::Int)
                 {
-                    int val = mStack[mStack.size() - 2].getStmtVal(args[pi - entry->param_begin()])->getInt32();
-                    bindDeclToStack(paraVarDecl, new Object(val));
+                    int val = mStack[mStack.size() - 2].getStmtVal(args[pi - entry->param_begin()]).getInt32();
+                    bindDeclToStack(paraVarDecl, Value(val));
                 }
                 else
                     assert(0);
             }
             else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
             {
-                void *pointer = mStack[mStack.size() - 2].getStmtVal(args[pi - entry->param_begin()])->getPointer();
-                bindDeclToStack(paraVarDecl, new Object(pointer));
+                void *pointer = mStack[mStack.size() - 2].getStmtVal(args[pi - entry->param_begin()]).getPointer();
+                bindDeclToStack(paraVarDecl, Value(pointer));
             }
             else
             {
@@ -98,11 +137,95 @@ void Environment::startNewFrame(FunctionDecl *entry, Expr **args = nullptr)
     llvm::errs() << "\n";
 #endif
     mVisitor->Visit(entry->getBody());
+
+    // return f(...) left its callee behind, run it in this frame
+    while (mFlow == FLOW_TAIL_CALL)
+    {
+        mFlow = FLOW_NORMAL;
+        entry = mTailCallee->getDefinition();
+        StackFrame &frame = mStack.back();
+        frame.reset(getLayout(entry), mArena);
+        ++mMemCounters.framesReused;
+        for (unsigned i = 0; i < entry->getNumParams(); ++i)
+            frame.bindDecl(entry->getParamDecl(i), mTailArgs[i]);
+        if (mProfiler)
+        {
+            mProfiler->leaveFunction();
+            mProfiler->enterFunction(entry, false);
+        }
+        if (mPerf)
+            mPerf->switchFunction(entry);
+        mVisitor->Visit(entry->getBody());
+    }
+    if (mProfiler)
+        mProfiler->leaveFunction();
+    if (mPerf)
+        mPerf->leaveFunction();
+}
+
+void *Environment::newArray(size_t size, Object::ELE_TYPE type)
+{
+    Object array(mArena, size, type);
+    ++mMemCounters.arrays;
+    mMemCounters.arrayBytes += array.bytes();
+    return array.getAddress();
+}
+
+uint32_t Environment::mallocSite(CallExpr *call)
+{
+    if (!mMemStats)
+        return 0;
+    std::map<CallExpr *, uint32_t>::iterator it = mMallocSiteIndex.find(call);
+    if (it != mMallocSiteIndex.end())
+        return it->second;
+    mMallocSites.push_back(std::make_pair(call, mStack.back().getLayout()->getFunction()));
+    return mMallocSiteIndex[call] = mMallocSites.size();
 }
 
-void Environment::initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visitor)
+void Environment::reportMemory(llvm::raw_ostream &os, const SourceManager &sources)
+{
+    os << "frames : " << mMemCounters.framesCreated << " created, " << mMemCounters.framesDestroyed << " destroyed, "
+       << mMemCounters.framesReused << " reused by tail calls, " << mStack.size() << " live, "
+       << mMemCounters.maxDepth << " deepest\n"
+       << "  frame arena " << mArena.used() << " bytes held, peak " << mArena.peak() << " bytes, reserved "
+       << mArena.reserved() << " bytes\n"
+       << "  " << mMemCounters.arrays << " local arrays, " << mMemCounters.arrayBytes
+       << " bytes in all, released with their frames\n";
+    mHeap->report(os);
+
+    std::vector<GuestHeap::Leak> leaks = mHeap->leaks();
+    uint64_t blocks = 0, bytes = 0;
+    for (const GuestHeap::Leak &leak : leaks)
+    {
+        blocks += leak.blocks;
+        bytes += leak.bytes;
+    }
+    os << "never freed : " << blocks << " blocks, " << bytes << " bytes\n";
+    for (const GuestHeap::Leak &leak : leaks)
+    {
+        os << llvm::format_decimal(leak.blocks, 10) << " blocks" << llvm::format_decimal(leak.bytes, 12) << " bytes  ";
+        if (leak.site == 0 || leak.site > mMallocSites.size())
+        {
+            os << "unknown site\n";
+            continue;
+        }
+        const std::pair<CallExpr *, FunctionDecl *> &site = mMallocSites[leak.site - 1];
+        PresumedLoc presumed = sources.getPresumedLoc(sources.getExpansionLoc(site.first->getBeginLoc()));
+        if (presumed.isValid())
+            os << presumed.getFilename() << ":" << presumed.getLine() << ":" << presumed.getColumn() << " ";
+        os << "in " << site.second->getNameAsString() << "\n";
+    }
+}
+
+void Environment::initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visitor, GuestIO *io)
 {
     mVisitor = visitor;
+    mIO = io;
+    mHeap.reset(new GuestHeap(mHeapBytes));
+    if (!mProfilePrefix.empty())
+        mProfiler.reset(new Profiler(unit->getASTContext().getSourceManager()));
+    if (mPerfCounters)
+        mPerf.reset(new PerfCounters());
     for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
     {
         if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
@@ -117,11 +240,6 @@ void Environment::initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visi
                 mOutput = fdecl;
             else if (fdecl->getName().equals("main"))
                 mEntry = fdecl;
-            else
-            {
-                // custom function
-                // do nothing
-            }
         }
         else if (VarDecl *varDecl = dyn_cast<VarDecl>(*i))
         {
@@ -136,14 +254,14 @@ void Environment::initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visi
                         if (varDecl->evaluateValue()->hasValue() && varDecl->evaluateValue()->isInt())
                         {
                             int val = varDecl->evaluateValue()->getInt().getSExtValue();
-                            bindDeclToStatic(varDecl, new Object(val));
+                            bindDeclToStatic(varDecl, Value(val));
                         }
                         else
                             assert(0);
                     }
                     else
                     {
-                        bindDeclToStatic(varDecl, new Object(0));
+                        bindDeclToStatic(varDecl, Value(0));
                     }
                 }
                 else
@@ -160,115 +278,76 @@ void Environment::initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visi
             assert(0);
     }
 
-    startNewFrame(mEntry);
-}
-
-/// !TODO Support comparison operation
-void Environment::binop(BinaryOperator *bop)
-{
+    // the static segment is complete, number every body and resolve its variable references
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
+    {
+        if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
+            if (fdecl->hasBody())
+                getLayout(fdecl);
+    }
 
-    Expr *left = bop->getLHS();
-    Expr *right = bop->getRHS();
-    const Type *type = bop->getType().getTypePtr();
-    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
+    if (mMemoize)
     {
-        if (builtinType->getKind() == BuiltinType::Kind::Int)
+        PurityAnalysis purity(unit);
+        for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
         {
-            if (bop->getOpcode() == BinaryOperator::Opcode::BO_Assign)
+            FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+            if (fdecl != NULL && fdecl->isThisDeclarationADefinition() && purity.isMemoizable(fdecl))
             {
-                int32_t val = getStmtVal(right)->getInt32();
-                *(int32_t *)getStmtVal(left)->getPointer() = val;
-                bindStmtToStack(bop, new Object(val));
-#ifdef DEBUG
-                llvm::errs() << "(int) asssign addr : " << getStmtVal(left)->getPointer() << " : " << val << "\n";
-#endif
+                mMemoIndex[fdecl->getCanonicalDecl()] = mMemoNames.size();
+                mMemoNames.push_back(fdecl->getNameAsString());
             }
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Add)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() + getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Sub)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() - getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Mul)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() * getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Div)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() / getStmtVal(right)->getInt32()));
-            else
-                assert(0);
-        }
-        else if (builtinType->getKind() == BuiltinType::Kind::ULong)
-        {
-            if (bop->getOpcode() == BinaryOperator::Opcode::BO_Add)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getUInt64() + getStmtVal(right)->getUInt64()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Sub)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getUInt64() - getStmtVal(right)->getUInt64()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Mul)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getUInt64() * getStmtVal(right)->getUInt64()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Div)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getUInt64() / getStmtVal(right)->getUInt64()));
-            else
-                assert(0);
         }
-        else if (builtinType->getKind() == BuiltinType::Kind::Bool)
-        {
-            if (bop->getOpcode() == BinaryOperator::Opcode::BO_EQ)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() == getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_NE)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() != getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_LT)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() < getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_GT)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() > getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_LE)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() <= getStmtVal(right)->getInt32()));
-            else if (bop->getOpcode() == BinaryOperator::Opcode::BO_GE)
-                bindStmtToStack(bop, new Object(getStmtVal(left)->getInt32() >= getStmtVal(right)->getInt32()));
+        if (!mMemoNames.empty())
+            mMemo.reset(new MemoTable(mMemoNames.size()));
+    }
 
-            else
-                assert(0);
+    if (!mSamplePrefix.empty())
+    {
+        mSampler.reset(new Sampler(unit->getASTContext().getSourceManager(), mSampleInterval));
+        if (!mSampler->start())
+        {
+            llvm::errs() << "cannot start the sampling timer, running without samples\n";
+            mSampler.reset();
         }
-        else
-            assert(0);
     }
-    else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
-    {
 
-        if (bop->getOpcode() == BinaryOperator::Opcode::BO_Assign)
-        {
-            void *val = (void *)getStmtVal(right)->getPointer();
-            *(void **)(getStmtVal(left)->getPointer()) = val;
-            bindStmtToStack(bop, new Object(val));
+    startNewFrame(mEntry);
+
+    if (mSampler)
+        mSampler->stop();
+
+    bool memoStats = mMemo && mMemoStats;
+    if (memoStats || mHeapStats || mPerf || mMemStats)
+    {
+        // keep the reports after the guest's own output
+        mIO->flush();
+        if (memoStats)
+            mMemo->report(llvm::errs(), mMemoNames);
+        // the memory stats include the heap's
+        if (mMemStats)
+            reportMemory(llvm::errs(), unit->getASTContext().getSourceManager());
+        else if (mHeapStats)
+            mHeap->report(llvm::errs());
+        if (mPerf)
+            mPerf->report(llvm::errs());
+    }
+    if (mProfiler && !mProfiler->write(mProfilePrefix))
+        llvm::errs() << "cannot write the profile to " << mProfilePrefix << ".annotated / .folded\n";
+    if (mSampler && !mSampler->write(mSamplePrefix))
+        llvm::errs() << "cannot write the samples to " << mSamplePrefix << ".samples / .samples.folded\n";
+}
+
+void Environment::binop(BinaryOperator *bop)
+{
+    StackFrame &frame = mStack.back();
+    unsigned slot = frame.getLayout()->stmtSlot(bop);
+    BinaryOperation operation = frame.getLayout()->operation(slot).binary;
+    assert(operation != nullptr);
+    operation(*frame.getSlot(slot), getStmtVal(bop->getLHS()), getStmtVal(bop->getRHS()));
 #ifdef DEBUG
-            llvm::errs() << "point asssign addr : " << getStmtVal(left)->getPointer() << " : " << val << "\n";
+    llvm::errs() << "binop " << bop->getOpcodeStr() << "\n";
 #endif
-        }
-        else if (bop->getOpcode() == BinaryOperator::Opcode::BO_Add)
-        {
-            const Type *pointeeType = pointerType->getPointeeType().getTypePtr();
-            if (const BuiltinType *builtinPointeeType = dyn_cast<BuiltinType>(pointeeType))
-            {
-                if (builtinPointeeType->getKind() == BuiltinType::Kind::Int)
-                {
-                    bindStmtToStack(bop, new Object((int *)getStmtVal(left)->getPointer() + getStmtVal(right)->getInt32()));
-                }
-                else
-                {
-                    assert(0);
-                }
-            }
-            else if (const PointerType *pointerPointeeType = dyn_cast<PointerType>(pointeeType))
-            {
-            }
-            else
-            {
-                assert(0);
-            }
-        }
-        else
-        {
-            assert(0);
-        }
-    }
-    else
-        assert(0);
 }
 
 void Environment::decl(DeclStmt *declstmt)
@@ -288,14 +367,14 @@ void Environment::decl(DeclStmt *declstmt)
                     if (vardecl->hasInit())
                     {
                         mVisitor->Visit(vardecl->getInit());
-                        bindDeclToStack(vardecl, new Object(getStmtVal(vardecl->getInit())->getInt32()));
+                        bindDeclToStack(vardecl, Value(getStmtVal(vardecl->getInit()).getInt32()));
                     }
                     else
                     {
-                        bindDeclToStack(vardecl, new Object(0));
+                        bindDeclToStack(vardecl, Value(0));
                     }
 #ifdef DEBUG
-                    Object *debugObj = searchDeclVal(vardecl);
+                    Value *debugObj = searchDeclVal(vardecl);
                     llvm::errs() << "int Decl Addr : " << debugObj->getAddress() << " : " << debugObj->getInt32() << "\n";
 #endif
                 }
@@ -308,35 +387,47 @@ void Environment::decl(DeclStmt *declstmt)
                 const Type *type = constArrayType->getElementType().getTypePtr();
                 if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
                 {
-                    if (builtinType->getKind() == BuiltinType::Kind::Int)
+                    if (builtinType->getKind() == BuiltinType::Kind::Char_S ||
+                        builtinType->getKind() == BuiltinType::Kind::SChar)
+                    {
+                        void *array = newArray(size, Object::CHAR);
+                        if (vardecl->hasInit())
+                        {
+                            //! TODO array init
+                            assert(0);
+                        }
+                        bindDeclToStack(decl, Value(array));
+                    }
+                    else if (builtinType->getKind() == BuiltinType::Kind::Int)
                     {
-                        Object *arrObj = new Object(true, size, Object::INT32);
+                        void *array = newArray(size, Object::INT32);
+                        // the variable's slot holds the array base, declref hands it out as is
                         if (vardecl->hasInit())
                         {
                             //! TODO array init
                             assert(0);
                         }
-                        bindDeclToStack(decl, arrObj);
+                        bindDeclToStack(decl, Value(array));
                     }
                     else
                         assert(0);
                 }
                 else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
                 {
-                    Object *pointerArrObj = new Object(true, size, Object::POINTER);
+                    void *array = newArray(size, Object::POINTER);
                     if (vardecl->hasInit())
                     {
                         //! TODO array init
                         assert(0);
                     }
-                    bindDeclToStack(decl, pointerArrObj);
+                    bindDeclToStack(decl, Value(array));
                 }
                 else
                     assert(0);
             }
             else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
             {
-                Object *pointerObj = new Object(nullptr);
+                Value pointerObj = Value(nullptr);
                 if (vardecl->hasInit())
                 {
                     //! TODO pointer init
@@ -344,7 +435,7 @@ void Environment::decl(DeclStmt *declstmt)
                 }
                 bindDeclToStack(decl, pointerObj);
 #ifdef DEBUG
-                Object *debugObj = searchDeclVal(decl);
+                Value *debugObj = searchDeclVal(decl);
                 llvm::errs() << "point Decl Addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
 #endif
             }
@@ -356,19 +447,29 @@ void Environment::decl(DeclStmt *declstmt)
     }
 }
 
+Value *Environment::resolvedDeclVal(StackFrame &frame, unsigned slot)
+{
+    const FunctionLayout::VarRef &ref = frame.getLayout()->varRef(slot);
+    if (ref.kind == FunctionLayout::VarRef::LOCAL)
+        return frame.getSlot(ref.index);
+    return mStatic.getSlot(ref.index);
+}
+
 void Environment::declref(DeclRefExpr *declref)
 {
-    mStack.back().setPC(declref);
+    StackFrame &frame = mStack.back();
+    frame.setPC(declref);
     const Type *type = declref->getType().getTypePtr();
 
     if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
     {
         if (builtinType->getKind() == BuiltinType::Kind::Int)
         {
-            bindStmtToStack(declref, new Object(searchDeclVal(declref->getFoundDecl())->getAddress()));
+            unsigned slot = frame.getLayout()->stmtSlot(declref);
+            *frame.getSlot(slot) = Value(resolvedDeclVal(frame, slot)->getAddress());
 #ifdef DEBUG
-            Object *debugObj = getStmtVal(declref);
-            llvm::errs() << "int Declref Addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
+            const Value &debugObj = getStmtVal(declref);
+            llvm::errs() << "int Declref : " << debugObj.getPointer() << "\n";
 #endif
         }
         else
@@ -376,14 +477,16 @@ void Environment::declref(DeclRefExpr *declref)
     }
     else if (declref->getType()->isConstantArrayType())
     {
-        bindStmtToStack(declref, new Object(searchDeclVal(declref->getFoundDecl())->getAddress()));
+        unsigned slot = frame.getLayout()->stmtSlot(declref);
+        *frame.getSlot(slot) = Value(resolvedDeclVal(frame, slot)->getPointer());
     }
     else if (declref->getType()->isPointerType())
     {
-        bindStmtToStack(declref, new Object(searchDeclVal(declref->getFoundDecl())->getAddress()));
+        unsigned slot = frame.getLayout()->stmtSlot(declref);
+        *frame.getSlot(slot) = Value(resolvedDeclVal(frame, slot)->getAddress());
 #ifdef DEBUG
-        Object *debugObj = getStmtVal(declref);
-        llvm::errs() << "point Declref Addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
+        const Value &debugObj = getStmtVal(declref);
+        llvm::errs() << "point Declref : " << debugObj.getPointer() << "\n";
 #endif
     }
     else if (declref->getType()->isFunctionType())
@@ -397,77 +500,15 @@ void Environment::declref(DeclRefExpr *declref)
 
 void Environment::cast(CastExpr *castexpr)
 {
-    mStack.back().setPC(castexpr);
-    const Type *type = castexpr->getType().getTypePtr();
-    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
-    {
-        if (builtinType->getKind() == BuiltinType::Kind::Int)
-        {
-            if (castexpr->getCastKind() == CastKind::CK_LValueToRValue)
-            {
-                bindStmtToStack(castexpr, new Object(*(int32_t *)getStmtVal(castexpr->getSubExpr())->getPointer()));
-#ifdef DEBUG
-                Object *debugObj = getStmtVal(castexpr);
-                llvm::errs() << "int l2r cast Addr : " << debugObj->getAddress() << " : " << debugObj->getInt32() << "\n";
-#endif
-            }
-            else if (castexpr->getCastKind() == CastKind::CK_IntegralCast)
-            {
-                Object *obj = getStmtVal(castexpr->getSubExpr());
-                if (obj->isUInt64())
-                {
-                    bindStmtToStack(castexpr, new Object(int(obj->getUInt64())));
-                }
-                else
-                    assert(0);
-            }
-            else
-                assert(0);
-        }
-        else if (builtinType->getKind() == BuiltinType::Kind::ULong)
-        {
-            if (castexpr->getCastKind() == CastKind::CK_IntegralCast)
-            {
-                Object *obj = getStmtVal(castexpr->getSubExpr());
-                if (obj->isInt32())
-                {
-                    bindStmtToStack(castexpr, new Object(uint64_t(obj->getInt32())));
-                }
-                else
-                    assert(0);
-            }
-            else
-                assert(0);
-        }
-        else
-            assert(0);
-    }
-    else if (castexpr->getType()->isPointerType() && !castexpr->getSubExpr()->getType()->isFunctionType())
-    {
-        if (castexpr->getCastKind() == CastKind::CK_LValueToRValue)
-        {
-            bindStmtToStack(castexpr, new Object(*(void **)getStmtVal(castexpr->getSubExpr())->getPointer()));
-#ifdef DEBUG
-            Object *debugObj = getStmtVal(castexpr);
-            llvm::errs() << "point l2r cast Addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
-#endif
-        }
-        else
-        {
-            bindStmtToStack(castexpr, new Object(getStmtVal(castexpr->getSubExpr())->getPointer()));
+    StackFrame &frame = mStack.back();
+    frame.setPC(castexpr);
+    unsigned slot = frame.getLayout()->stmtSlot(castexpr);
+    UnaryOperation operation = frame.getLayout()->operation(slot).unary;
+    assert(operation != nullptr);
+    operation(*frame.getSlot(slot), getStmtVal(castexpr->getSubExpr()));
 #ifdef DEBUG
-            Object *debugObj = getStmtVal(castexpr);
-            llvm::errs() << "point cast Addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
+    llvm::errs() << "cast " << castexpr->getCastKindName() << "\n";
 #endif
-        }
-    }
-    else if (castexpr->getType()->isFunctionPointerType())
-    {
-        // function cast
-        // do nothing
-    }
-    else
-        assert(0);
 }
 
 /// !TODO Support Function Call
@@ -478,38 +519,67 @@ void Environment::call(CallExpr *callexpr)
     FunctionDecl *callee = callexpr->getDirectCallee();
     if (callee == mInput)
     {
-        int32_t val;
-        llvm::errs() << "Please Input an Integer Value : ";
-        scanf("%d", &val);
-        bindStmtToStack(callexpr, new Object(val));
+        bindStmtToStack(callexpr, Value(mIO->get()));
     }
     else if (callee == mOutput)
     {
         Expr *decl = callexpr->getArg(0);
-        int32_t val = getStmtVal(decl)->getInt32();
-        llvm::errs() << val;
+        int32_t val = getStmtVal(decl).getInt32();
+        mIO->print(val);
     }
     else if (callee == mMalloc)
     {
-        int32_t size = getStmtVal(callexpr->getArg(0))->getInt32();
-        void *pointerVal = malloc(sizeof(size));
-        bindStmtToStack(callexpr, new Object(pointerVal));
+        int32_t size = getStmtVal(callexpr->getArg(0)).getInt32();
+        void *pointerVal = mHeap->allocate(size, mallocSite(callexpr));
+        bindStmtToStack(callexpr, Value(pointerVal));
 #ifdef DEBUG
         llvm::errs() << "call malloc : " << pointerVal << "\n";
 #endif
     }
     else if (callee == mFree)
     {
-        void *pointerVal = getStmtVal(callexpr->getArg(0))->getPointer();
-        free(pointerVal);
+        void *pointerVal = getStmtVal(callexpr->getArg(0)).getPointer();
+        mHeap->free(pointerVal);
     }
     else
     {
+        // a pure callee seen with the same arguments before needs no frame
+        MemoTable::Ticket ticket;
+        std::map<FunctionDecl *, int32_t>::iterator memo;
+        bool memoized = mMemo && (memo = mMemoIndex.find(callee->getCanonicalDecl())) != mMemoIndex.end();
+        // the memo table needs the callee's result here, so memoized calls never leave early
+        if (!memoized && mStack.back().getLayout()->isTailCall(mStack.back().getLayout()->stmtSlot(callexpr)))
+        {
+            mTailCallee = callee;
+            mTailArgs.clear();
+            for (unsigned i = 0; i < callexpr->getNumArgs(); ++i)
+                mTailArgs.push_back(Value(getStmtVal(callexpr->getArg(i)).getInt32()));
+            mFlow = FLOW_TAIL_CALL;
+            return;
+        }
+        if (memoized)
+        {
+            int32_t args[MemoTable::MAX_ARGS];
+            for (unsigned i = 0; i < callexpr->getNumArgs(); ++i)
+                args[i] = getStmtVal(callexpr->getArg(i)).getInt32();
+            int32_t result;
+            if (mMemo->lookup(memo->second, args, callexpr->getNumArgs(), result, ticket))
+            {
+                bindStmtToStack(callexpr, Value(result));
+                return;
+            }
+        }
         // create and visit function
         startNewFrame(callee, callexpr->getArgs());
-        Object *retVal = mStack.back().getReturn();
-        // delete frame
+        // the callee's return stops unwinding here
+        mFlow = FLOW_NORMAL;
+        Value retVal = mStack.back().getReturn();
+        // delete frame, its slots and arrays go back to the arena in one step
+        mArena.release(mStack.back().getArenaMark());
         mStack.pop_back();
+        ++mMemCounters.framesDestroyed;
+        if (ticket.entry)
+            mMemo->complete(ticket, retVal.getInt32());
         bindStmtToStack(callexpr, retVal);
 #ifdef DEBUG
         const Type *type = callexpr->getType().getTypePtr();
@@ -517,8 +587,8 @@ void Environment::call(CallExpr *callexpr)
         {
             if (builtinType->getKind() == BuiltinType::Kind::Int)
             {
-                Object *debugObj = getStmtVal(callexpr);
-                llvm::errs() << "call return int : " << debugObj->getInt32() << "\n";
+                const Value &debugObj = getStmtVal(callexpr);
+                llvm::errs() << "call return int : " << debugObj.getInt32() << "\n";
             }
             else if (builtinType->getKind() == BuiltinType::Kind::Void)
             {
@@ -537,20 +607,28 @@ void Environment::call(CallExpr *callexpr)
 
 void Environment::integerLiteral(IntegerLiteral *integer)
 {
-    const Type *type = integer->getType().getTypePtr();
-    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
-    {
-        if (builtinType->getKind() == BuiltinType::Kind::Int)
-        {
-            mStack.back().setPC(integer);
-            int32_t val = integer->getValue().getSExtValue();
-            bindStmtToStack(integer, new Object(val));
-        }
-        else
-            assert(0);
-    }
-    else
-        assert(0);
+    StackFrame &frame = mStack.back();
+    frame.setPC(integer);
+    unsigned slot = frame.getLayout()->stmtSlot(integer);
+    const Value &val = frame.getLayout()->literal(slot);
+    assert(!val.isNull());
+    *frame.getSlot(slot) = val;
+}
+
+void Environment::characterLiteral(CharacterLiteral *character)
+{
+    StackFrame &frame = mStack.back();
+    frame.setPC(character);
+    unsigned slot = frame.getLayout()->stmtSlot(character);
+    const Value &val = frame.getLayout()->literal(slot);
+    assert(!val.isNull());
+    *frame.getSlot(slot) = val;
+}
+
+void Environment::boolLiteral(CXXBoolLiteralExpr *boolean)
+{
+    mStack.back().setPC(boolean);
+    bindStmtToStack(boolean, Value(boolean->getValue()));
 }
 
 void Environment::ifStmt(IfStmt *ifStmt)
@@ -558,7 +636,7 @@ void Environment::ifStmt(IfStmt *ifStmt)
     mStack.back().setPC(ifStmt);
     mVisitor->Visit(ifStmt->getCond());
 
-    bool condResult = getStmtVal(ifStmt->getCond())->getBool();
+    bool condResult = getStmtVal(ifStmt->getCond()).getBool();
 
     if (condResult)
         mVisitor->Visit(ifStmt->getThen());
@@ -569,7 +647,17 @@ void Environment::ifStmt(IfStmt *ifStmt)
 void Environment::returnStmt(ReturnStmt *returnStmt)
 {
     mStack.back().setPC(returnStmt);
-    Object *returnValue = nullptr;
+    // the returned call runs once this frame has unwound
+    if (mFlow == FLOW_TAIL_CALL)
+        return;
+    Value returnValue;
+    if (returnStmt->getRetValue() == NULL)
+    {
+        // return; from a void function
+        mStack.back().setReturn(returnValue);
+        mFlow = FLOW_RETURN;
+        return;
+    }
 
     const Type *type = returnStmt->getRetValue()->getType().getTypePtr();
     if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
@@ -577,63 +665,53 @@ void Environment::returnStmt(ReturnStmt *returnStmt)
         if (builtinType->getKind() == BuiltinType::Kind::Int)
         {
             // get return value
-            returnValue = new Object(getStmtVal(returnStmt->getRetValue())->getInt32());
+            returnValue = Value(getStmtVal(returnStmt->getRetValue()).getInt32());
         }
         else
             assert(0);
     }
     else
         assert(0);
-    // Void return
-    if (returnValue == nullptr)
-    {
-        returnValue = new Object();
-    }
     mStack.back().setReturn(returnValue);
+    mFlow = FLOW_RETURN;
 }
 
-void Environment::unaryOperator(UnaryOperator *unaryOperator)
+void Environment::breakStmt(BreakStmt *breakStmt)
 {
-    mStack.back().setPC(unaryOperator);
+    mStack.back().setPC(breakStmt);
+    mFlow = FLOW_BREAK;
+}
 
-    const Type *type = unaryOperator->getType().getTypePtr();
+void Environment::continueStmt(ContinueStmt *continueStmt)
+{
+    mStack.back().setPC(continueStmt);
+    mFlow = FLOW_CONTINUE;
+}
 
-    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
+/// After a loop body: true if the loop has to stop. break is consumed here,
+/// continue just ends the iteration, return keeps unwinding.
+bool Environment::leavesLoop()
+{
+    if (mFlow == FLOW_NORMAL)
+        return false;
+    if (mFlow == FLOW_CONTINUE)
     {
-        if (builtinType->getKind() == BuiltinType::Kind::Int)
-        {
-            if (unaryOperator->getOpcode() == UnaryOperator::Opcode::UO_Minus)
-                bindStmtToStack(unaryOperator, new Object(0 - getStmtVal(unaryOperator->getSubExpr())->getInt32()));
-            else if (unaryOperator->getOpcode() == UnaryOperator::Opcode::UO_Deref)
-            {
-                bindStmtToStack(unaryOperator, new Object((int32_t *)(getStmtVal(unaryOperator->getSubExpr())->getPointer())));
-#ifdef DEBUG
-                Object *debugObj = getStmtVal(unaryOperator);
-                llvm::errs() << "int Deref addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
-#endif
-            }
-            else
-                assert(0);
-        }
-        else
-            assert(0);
+        mFlow = FLOW_NORMAL;
+        return false;
     }
-    else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
-    {
-        if (unaryOperator->getOpcode() == UnaryOperator::Opcode::UO_Deref)
-        {
+    if (mFlow == FLOW_BREAK)
+        mFlow = FLOW_NORMAL;
+    return true;
+}
 
-            bindStmtToStack(unaryOperator, new Object((void *)(getStmtVal(unaryOperator->getSubExpr())->getPointer())));
-#ifdef DEBUG
-            Object *debugObj = getStmtVal(unaryOperator);
-            llvm::errs() << "point Deref addr : " << debugObj->getAddress() << " : " << debugObj->getPointer() << "\n";
-#endif
-        }
-        else
-            assert(0);
-    }
-    else
-        assert(0);
+void Environment::unaryOperator(UnaryOperator *unaryOperator)
+{
+    StackFrame &frame = mStack.back();
+    frame.setPC(unaryOperator);
+    unsigned slot = frame.getLayout()->stmtSlot(unaryOperator);
+    UnaryOperation operation = frame.getLayout()->operation(slot).unary;
+    assert(operation != nullptr);
+    operation(*frame.getSlot(slot), getStmtVal(unaryOperator->getSubExpr()));
 }
 
 void Environment::whileStmt(WhileStmt *whileStmt)
@@ -641,13 +719,18 @@ void Environment::whileStmt(WhileStmt *whileStmt)
     mStack.back().setPC(whileStmt);
 
     mVisitor->Visit(whileStmt->getCond());
-    bool condResult = getStmtVal(whileStmt->getCond())->getBool();
+    bool condResult = getStmtVal(whileStmt->getCond()).getBool();
     while (condResult)
     {
         mVisitor->Visit(whileStmt->getBody());
+        if (leavesLoop())
+            return;
+        // a body without braces is never checked between statements
+        if (Sampler::pending())
+            takeSample();
 
         mVisitor->Visit(whileStmt->getCond());
-        condResult = getStmtVal(whileStmt->getCond())->getBool();
+        condResult = getStmtVal(whileStmt->getCond()).getBool();
     }
 }
 
@@ -658,44 +741,32 @@ void Environment::forStmt(ForStmt *forStmt)
         mVisitor->Visit(forStmt->getInit());
     if (forStmt->getCond() != NULL)
         mVisitor->Visit(forStmt->getCond());
-    bool condResult = forStmt->getCond() == NULL ? true : getStmtVal(forStmt->getCond())->getBool();
+    bool condResult = forStmt->getCond() == NULL ? true : getStmtVal(forStmt->getCond()).getBool();
     while (condResult)
     {
         mVisitor->Visit(forStmt->getBody());
+        if (leavesLoop())
+            return;
+        if (Sampler::pending())
+            takeSample();
         if (forStmt->getInc() != NULL)
             mVisitor->Visit(forStmt->getInc());
         if (forStmt->getCond() != NULL)
             mVisitor->Visit(forStmt->getCond());
-        condResult = forStmt->getCond() == NULL ? true : getStmtVal(forStmt->getCond())->getBool();
+        condResult = forStmt->getCond() == NULL ? true : getStmtVal(forStmt->getCond()).getBool();
         ;
     }
 }
 
 void Environment::arraySubscriptExpr(ArraySubscriptExpr *arraySubscriptExpr)
 {
-    mStack.back().setPC(arraySubscriptExpr);
-
-    void *pointer = getStmtVal(arraySubscriptExpr->getLHS())->getPointer();
-    int64_t offset = getStmtVal(arraySubscriptExpr->getRHS())->getInt32();
-
-    const Type *type = arraySubscriptExpr->getType().getTypePtr();
-    if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
-    {
-        if (builtinType->getKind() == BuiltinType::Kind::Int)
-        {
-            bindStmtToStack(arraySubscriptExpr, new Object(pointer, Object::ELE_TYPE::INT32, offset));
-        }
-        else
-            assert(0);
-    }
-    else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
-    {
-        bindStmtToStack(arraySubscriptExpr, new Object(pointer, Object::ELE_TYPE::POINTER, offset));
-    }
-    else
-    {
-        assert(0);
-    }
+    StackFrame &frame = mStack.back();
+    frame.setPC(arraySubscriptExpr);
+    // the node's value is the element address, base + index * element width
+    unsigned slot = frame.getLayout()->stmtSlot(arraySubscriptExpr);
+    BinaryOperation operation = frame.getLayout()->operation(slot).binary;
+    assert(operation != nullptr);
+    operation(*frame.getSlot(slot), getStmtVal(arraySubscriptExpr->getBase()), getStmtVal(arraySubscriptExpr->getIdx()));
 }
 
 void Environment::unaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *unaryExprOrTypeTraitExpr)
@@ -709,13 +780,15 @@ void Environment::unaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *unaryExprOr
         {
             const BuiltinType *builtinType = dyn_cast<BuiltinType>(type);
             if (builtinType->getKind() == BuiltinType::Int)
-                bindStmtToStack(unaryExprOrTypeTraitExpr, new Object(sizeof(int)));
+                bindStmtToStack(unaryExprOrTypeTraitExpr, Value(sizeof(int)));
+            else if (builtinType->getKind() == BuiltinType::Char_S || builtinType->getKind() == BuiltinType::SChar)
+                bindStmtToStack(unaryExprOrTypeTraitExpr, Value(sizeof(char)));
             else
                 assert(0);
         }
         else if (type->isPointerType())
         {
-            bindStmtToStack(unaryExprOrTypeTraitExpr, new Object(sizeof(void *)));
+            bindStmtToStack(unaryExprOrTypeTraitExpr, Value(sizeof(void *)));
         }
     }
     else
@@ -733,14 +806,14 @@ void Environment::parenExpr(ParenExpr *parenExpr)
     {
         if (builtinType->getKind() == BuiltinType::Kind::Int)
         {
-            bindStmtToStack(parenExpr, new Object(getStmtVal(parenExpr->getSubExpr())->getInt32()));
+            bindStmtToStack(parenExpr, Value(getStmtVal(parenExpr->getSubExpr()).getInt32()));
         }
         else
             assert(0);
     }
     else if (const PointerType *pointerType = dyn_cast<PointerType>(type))
     {
-        bindStmtToStack(parenExpr, new Object(getStmtVal(parenExpr->getSubExpr())->getPointer()));
+        bindStmtToStack(parenExpr, Value(getStmtVal(parenExpr->getSubExpr()).getPointer()));
     }
     else
         assert(0);
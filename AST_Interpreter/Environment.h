@@ -1,8 +1,12 @@
 #pragma once
 #include <stdio.h>
+#include <deque>
+#include <map>
+#include <memory>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Decl.h"
+#include "clang/AST/ExprCXX.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
@@ -10,9 +14,16 @@
 
 using namespace clang;
 
+#include "GuestHeap.h"
+#include "GuestIO.h"
+#include "MemoTable.h"
+#include "PerfCounters.h"
+#include "Profiler.h"
+#include "Sampler.h"
 #include "StackFrame.h"
 #include "StaticFrame.h"
 #include "Object.h"
+#include "Value.h"
 
 // #define DEBUG
 
@@ -22,9 +33,31 @@ class Environment
 {
 private:
 	InterpreterVisitor *mVisitor;
+	/// How control leaves the statement being executed. Anything but
+	/// FLOW_NORMAL unwinds to the innermost loop (break / continue) or to
+	/// the function boundary (return) without running further statements.
+	/// FLOW_TAIL_CALL returns as well, startNewFrame then runs mTailCallee
+	/// in the same frame instead of the caller having recursed into it.
+	enum Flow
+	{
+		FLOW_NORMAL,
+		FLOW_BREAK,
+		FLOW_CONTINUE,
+		FLOW_RETURN,
+		FLOW_TAIL_CALL
+	};
+	Flow mFlow;
+	FunctionDecl *mTailCallee;
+	std::vector<Value> mTailArgs;
+	GuestIO *mIO;
 
-	std::vector<StackFrame> mStack;
+	/// a deque, so pushing a frame never moves the frames below it
+	std::deque<StackFrame> mStack;
+	/// backing store of every frame's slots and local arrays, released LIFO
+	FrameArena mArena;
 	StaticFrame mStatic;
+	/// slot numbering of every function, keyed by canonical declaration
+	std::map<FunctionDecl *, std::unique_ptr<FunctionLayout>> mLayouts;
 
 	FunctionDecl *mFree; /// Declartions to the built-in functions
 	FunctionDecl *mMalloc;
@@ -32,23 +65,100 @@ private:
 	FunctionDecl *mOutput;
 	FunctionDecl *mEntry; // main functions
 
+	bool mMemoize;
+	bool mMemoStats;
+	/// null unless memoizing and some function is memoizable
+	std::unique_ptr<MemoTable> mMemo;
+	/// MemoTable index of every memoizable function, keyed by canonical declaration
+	std::map<FunctionDecl *, int32_t> mMemoIndex;
+	std::vector<std::string> mMemoNames;
+
+	size_t mHeapBytes;
+	bool mHeapStats;
+	/// serves MALLOC / FREE, created per run
+	std::unique_ptr<GuestHeap> mHeap;
+
+	/// files the profile is written to, no profiling when empty
+	std::string mProfilePrefix;
+	/// null unless profiling, created per run
+	std::unique_ptr<Profiler> mProfiler;
+
+	/// files the samples are written to, no sampling when empty
+	std::string mSamplePrefix;
+	unsigned mSampleInterval;
+	std::unique_ptr<Sampler> mSampler;
+
+	bool mPerfCounters;
+	/// null unless counting, created per run
+	std::unique_ptr<PerfCounters> mPerf;
+
+	bool mMemStats;
+	/// frame and array counts of the run, reported with the memory stats
+	struct MemCounters
+	{
+		uint64_t framesCreated = 0;
+		uint64_t framesDestroyed = 0;
+		uint64_t framesReused = 0;
+		size_t maxDepth = 0;
+		uint64_t arrays = 0;
+		uint64_t arrayBytes = 0;
+	} mMemCounters;
+	/// MALLOC call (and its function) of every GuestHeap site tag but 0,
+	/// which stands for all calls while memory stats are off
+	std::vector<std::pair<CallExpr *, FunctionDecl *>> mMallocSites;
+	std::map<CallExpr *, uint32_t> mMallocSiteIndex;
+
 	// first search stack frame then search static frame
-	Object *searchDeclVal(Decl *decl);
-	void bindDeclToStack(Decl *decl, Object *val);
-	void bindDeclToStatic(Decl *decl, Object *val);
+	Value *searchDeclVal(Decl *decl);
+	void bindDeclToStack(Decl *decl, const Value &val);
+	void bindDeclToStatic(Decl *decl, const Value &val);
 
 	bool hasStmtVal(Stmt *stmt);
-	Object *getStmtVal(Stmt *stmt);
-	void bindStmtToStack(Stmt *stmt, Object *val);
+	const Value &getStmtVal(Stmt *stmt);
+	void bindStmtToStack(Stmt *stmt, const Value &val);
 
+	const FunctionLayout *getLayout(FunctionDecl *fdecl);
+	bool leavesLoop();
+	/// storage of the variable the DeclRefExpr numbered slot was resolved to
+	Value *resolvedDeclVal(StackFrame &frame, unsigned slot);
 	void startNewFrame(FunctionDecl *entry, Expr **args);
+	/// storage of a local array, carved from the current frame's arena
+	void *newArray(size_t size, Object::ELE_TYPE type);
+	uint32_t mallocSite(CallExpr *call);
+	/// frames, arrays, guest heap and the heap blocks never freed by allocating call
+	void reportMemory(llvm::raw_ostream &os, const SourceManager &sources);
 
 public:
 	/// Get the declartions to the built-in functions
 	Environment();
-	bool hasReturn();
+	bool isUnwinding()
+	{
+		return mFlow != FLOW_NORMAL;
+	}
 	/// Initialize the Environment
-	void initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visitor);
+	void initAndRun(TranslationUnitDecl *unit, InterpreterVisitor *visitor, GuestIO *io);
+	/// answer calls of pure int functions from a MemoTable, report its hits and misses after the run
+	void setMemoization(bool enabled, bool reportStats);
+	/// reserve reserveBytes for MALLOC, report heap usage after the run
+	void setHeap(size_t reserveBytes, bool reportStats);
+	/// profile statements and functions, write the report to prefix.annotated and prefix.folded
+	void setProfile(const std::string &prefix);
+	Profiler *getProfiler()
+	{
+		return mProfiler.get();
+	}
+	/// sample the guest stack every intervalMicros of CPU time, write the samples to prefix.samples and prefix.samples.folded
+	void setSampling(const std::string &prefix, unsigned intervalMicros);
+	/// charge host hardware counters to guest functions, report them after the run
+	void setPerfCounters(bool enabled);
+	/// report memory use and leaked guest heap blocks after the run
+	void setMemStats(bool enabled);
+	/// record the stack, called once Sampler::pending() is set
+	void takeSample()
+	{
+		if (mSampler)
+			mSampler->sample(mStack);
+	}
 	FunctionDecl *getMainEntry();
 	void binop(BinaryOperator *bop);
 	void decl(DeclStmt *declstmt);
@@ -57,8 +167,12 @@ public:
 	void call(CallExpr *callexpr);
 	// added function ---------------------------------------------------
 	void integerLiteral(IntegerLiteral *integer);
+	void characterLiteral(CharacterLiteral *character);
+	void boolLiteral(CXXBoolLiteralExpr *boolean);
 	void ifStmt(IfStmt *ifStmt);
 	void returnStmt(ReturnStmt *returnStmt);
+	void breakStmt(BreakStmt *breakStmt);
+	void continueStmt(ContinueStmt *continueStmt);
 	void unaryOperator(UnaryOperator *unaryOperator);
 	void whileStmt(WhileStmt *whileStmt);
 	void forStmt(ForStmt *forStmt);
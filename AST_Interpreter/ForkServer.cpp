@@ -0,0 +1,115 @@
+#include "ForkServer.h"
+
+#include <sys/wait.h>
+#include <errno.h>
+#include <unistd.h>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <string>
+
+ForkServer::ForkServer(const CompiledProgram &program, unsigned jobs) : mProgram(program), mJobs(jobs ? jobs : 1)
+{
+}
+
+unsigned ForkServer::sweep(std::istream &vectors, llvm::raw_ostream &os)
+{
+    unsigned failed = 0;
+    // GET and PRINT are rebound in every child before it runs main
+    GuestIO io;
+    std::unique_ptr<VM> vm = mProgram.prepareVM(io);
+    // children in input order, the oldest one is always drained first, so
+    // a younger one blocked on a full pipe only waits for its turn
+    std::deque<Child> running;
+    std::string text;
+    for (unsigned line = 1; std::getline(vectors, text); ++line)
+    {
+        if (!text.empty() && text[0] == '#')
+            continue;
+        std::vector<int32_t> inputs;
+        std::istringstream values(text);
+        int32_t value;
+        while (values >> value)
+            inputs.push_back(value);
+
+        if (running.size() == mJobs)
+        {
+            failed += !collect(running.front(), os);
+            running.pop_front();
+        }
+        // the child must not write what the parent has buffered a second time
+        os.flush();
+        Child child = spawn(line, inputs, io, vm.get());
+        if (child.pid < 0)
+        {
+            os << line << ": ! cannot fork\n";
+            ++failed;
+            continue;
+        }
+        running.push_back(child);
+    }
+    for (const Child &child : running)
+        failed += !collect(child, os);
+    os.flush();
+    return failed;
+}
+
+ForkServer::Child ForkServer::spawn(unsigned line, const std::vector<int32_t> &inputs, GuestIO &io, VM *vm)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return Child{-1, -1, line};
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return Child{-1, -1, line};
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        io.rebind(&inputs, fds[1]);
+        if (vm)
+            vm->run();
+        else
+            mProgram.run(io);
+        // no atexit handlers or static destructors of the parent's state
+        _exit(0);
+    }
+    close(fds[1]);
+    return Child{pid, fds[0], line};
+}
+
+bool ForkServer::collect(const Child &child, llvm::raw_ostream &os)
+{
+    std::vector<char> bytes;
+    char buffer[1 << 16];
+    ssize_t got;
+    while ((got = read(child.fd, buffer, sizeof(buffer))) != 0)
+    {
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        bytes.insert(bytes.end(), buffer, buffer + got);
+    }
+    close(child.fd);
+    int status = 0;
+    while (waitpid(child.pid, &status, 0) < 0 && errno == EINTR)
+        ;
+
+    os << child.line << ":";
+    const int32_t *values = (const int32_t *)bytes.data();
+    for (size_t i = 0; i < bytes.size() / sizeof(int32_t); ++i)
+        os << " " << values[i];
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (WIFSIGNALED(status))
+        os << " ! signal " << WTERMSIG(status);
+    else if (!ok)
+        os << " ! exit " << WEXITSTATUS(status);
+    os << "\n";
+    return ok;
+}
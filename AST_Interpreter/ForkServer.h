@@ -0,0 +1,48 @@
+#pragma once
+
+#include <sys/types.h>
+#include <cstdint>
+#include <istream>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Interpreter.h"
+
+/// Sweeps one compiled program over many GET input vectors. The program is
+/// parsed and lowered once and its VM built, with native code for every
+/// function, before the first fork; every vector then runs in a child that
+/// inherits all of it copy on write and only calls main, so a run costs its
+/// execution alone. The child writes each PRINT value to a pipe as it is
+/// produced; a crash or failed assert only takes that child down, and what
+/// it printed until then is still reported.
+class ForkServer
+{
+public:
+    /// jobs : children running at once, at least one
+    ForkServer(const CompiledProgram &program, unsigned jobs);
+
+    /// One vector per line of whitespace separated ints, lines starting
+    /// with # are skipped. Writes "<line>: <PRINT values>" per vector in
+    /// input order, followed by "! exit <status>" or "! signal <number>"
+    /// if the run did not end normally. Returns the number of such runs.
+    unsigned sweep(std::istream &vectors, llvm::raw_ostream &os);
+
+private:
+    struct Child
+    {
+        pid_t pid;
+        /// read end of the pipe the child writes its output to
+        int fd;
+        unsigned line;
+    };
+
+    const CompiledProgram &mProgram;
+    unsigned mJobs;
+
+    /// pid is -1 if the child could not be started. The child runs main on
+    /// vm, or on the walker if it is null, with GET and PRINT rebound on io.
+    Child spawn(unsigned line, const std::vector<int32_t> &inputs, GuestIO &io, VM *vm);
+    /// wait for child and report it, false if its run failed
+    bool collect(const Child &child, llvm::raw_ostream &os);
+};
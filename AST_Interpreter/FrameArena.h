@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+
+#include "llvm/Support/ErrorHandling.h"
+
+/// Bump pointer allocator for call frames.
+/// Frames are strictly LIFO, so a frame remembers mark() when it is pushed
+/// and hands it back to release() when it returns: everything it allocated
+/// (slots, temporaries, local arrays) is dropped in O(1) and the memory is
+/// reused by the next call at the same depth. Chunks are only returned to
+/// the system when the arena dies, so deep recursion keeps memory flat.
+class FrameArena
+{
+public:
+	struct Mark
+	{
+		size_t chunk;
+		char *ptr;
+	};
+
+	explicit FrameArena(size_t chunkSize = 1 << 20) : mChunkSize(chunkSize), mChunk(0), mPeak(0)
+	{
+		newChunk(0, mChunkSize);
+		mPtr = mChunks[0].begin;
+		mEnd = mChunks[0].end;
+	}
+	~FrameArena()
+	{
+		for (size_t i = 0; i < mChunks.size(); ++i)
+			free(mChunks[i].begin);
+	}
+	FrameArena(const FrameArena &) = delete;
+	FrameArena &operator=(const FrameArena &) = delete;
+
+	void *allocate(size_t bytes)
+	{
+		bytes = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+		if ((size_t)(mEnd - mPtr) < bytes)
+			nextChunk(bytes);
+		void *result = mPtr;
+		mPtr += bytes;
+		return result;
+	}
+	Mark mark() const
+	{
+		return Mark{mChunk, mPtr};
+	}
+	void release(const Mark &mark)
+	{
+		// usage only drops here, so the peak is always seen right before a release
+		size_t now = used();
+		if (now > mPeak)
+			mPeak = now;
+		mChunk = mark.chunk;
+		mPtr = mark.ptr;
+		mEnd = mChunks[mChunk].end;
+	}
+	/// bytes currently handed out, used chunks are counted in full
+	size_t used() const
+	{
+		size_t total = mPtr - mChunks[mChunk].begin;
+		for (size_t i = 0; i < mChunk; ++i)
+			total += mChunks[i].end - mChunks[i].begin;
+		return total;
+	}
+	/// most bytes handed out at once so far
+	size_t peak() const
+	{
+		size_t now = used();
+		return now > mPeak ? now : mPeak;
+	}
+	size_t reserved() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < mChunks.size(); ++i)
+			total += mChunks[i].end - mChunks[i].begin;
+		return total;
+	}
+
+private:
+	static const size_t ALIGN = 16;
+
+	struct Chunk
+	{
+		char *begin;
+		char *end;
+	};
+	std::vector<Chunk> mChunks;
+	size_t mChunkSize;
+	size_t mChunk;
+	char *mPtr;
+	char *mEnd;
+	/// highest used() seen by release()
+	size_t mPeak;
+
+	void newChunk(size_t index, size_t bytes)
+	{
+		Chunk chunk;
+		chunk.begin = (char *)aligned_alloc(ALIGN, bytes);
+		if (chunk.begin == nullptr)
+			llvm::report_fatal_error("cannot allocate a frame arena chunk");
+		chunk.end = chunk.begin + bytes;
+		if (index < mChunks.size())
+		{
+			free(mChunks[index].begin);
+			mChunks[index] = chunk;
+		}
+		else
+			mChunks.push_back(chunk);
+	}
+	/// move on to the next chunk, reusing it if it is large enough
+	void nextChunk(size_t bytes)
+	{
+		++mChunk;
+		if (mChunk >= mChunks.size() || (size_t)(mChunks[mChunk].end - mChunks[mChunk].begin) < bytes)
+			newChunk(mChunk, bytes > mChunkSize ? bytes : mChunkSize);
+		mPtr = mChunks[mChunk].begin;
+		mEnd = mChunks[mChunk].end;
+	}
+};
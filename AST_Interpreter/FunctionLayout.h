@@ -0,0 +1,202 @@
+#pragma once
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "Operations.h"
+#include "StaticFrame.h"
+
+using namespace clang;
+
+/// Dense slot numbering of one FunctionDecl, computed once before the first
+/// call. Parameters come first, then every local VarDecl, then every Expr of
+/// the body, so a StackFrame is a single Value array of numSlots() entries.
+/// Every DeclRefExpr to a variable is resolved here as well, once, to the
+/// frame slot or the static segment index it names, every operator node is
+/// bound to the handler for its operand types and every literal is converted
+/// to the Value it evaluates to.
+class FunctionLayout
+{
+public:
+	/// Storage a DeclRefExpr refers to
+	struct VarRef
+	{
+		enum KIND
+		{
+			NONE, // not a variable, e.g. a callee
+			LOCAL,
+			GLOBAL
+		};
+		KIND kind;
+		unsigned index;
+	};
+
+private:
+	llvm::DenseMap<const Decl *, unsigned> mVarSlots;
+	llvm::DenseMap<const Stmt *, unsigned> mExprSlots;
+	/// indexed by expression slot, only DeclRefExpr entries are set
+	std::vector<VarRef> mVarRefs;
+	/// indexed by expression slot, set for BinaryOperator, CastExpr, UnaryOperator and ArraySubscriptExpr
+	std::vector<Operation> mOperations;
+	/// indexed by expression slot, set for IntegerLiteral and CharacterLiteral
+	std::vector<Value> mLiterals;
+	/// indexed by expression slot, set for calls in tail position
+	std::vector<bool> mTailCalls;
+	std::vector<ReturnStmt *> mReturns;
+	unsigned mNumSlots;
+	FunctionDecl *mFunction;
+
+	void resolve(DeclRefExpr *declref, unsigned slot, const StaticFrame &statics)
+	{
+		if (!isa<VarDecl>(declref->getFoundDecl()))
+			return;
+		if (mVarRefs.size() <= slot)
+			mVarRefs.resize(slot + 1, VarRef{VarRef::NONE, 0});
+		const Decl *decl = declref->getFoundDecl();
+		// declarations precede their uses, so locals are numbered by now
+		if (hasDecl(decl))
+			mVarRefs[slot] = VarRef{VarRef::LOCAL, declSlot(decl)};
+		else
+			mVarRefs[slot] = VarRef{VarRef::GLOBAL, statics.declIndex(decl)};
+	}
+
+	void bindOperation(Stmt *stmt, unsigned slot)
+	{
+		if (mOperations.size() <= slot)
+			mOperations.resize(slot + 1, Operation());
+		if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt))
+			mOperations[slot].binary = selectBinary(bop);
+		else if (CastExpr *castExpr = dyn_cast<CastExpr>(stmt))
+			mOperations[slot].unary = selectCast(castExpr);
+		else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt))
+			mOperations[slot].unary = selectUnary(uop);
+		else if (ArraySubscriptExpr *subscript = dyn_cast<ArraySubscriptExpr>(stmt))
+			mOperations[slot].binary = selectSubscript(subscript);
+		else if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(stmt))
+			bindLiteral(integer, (uint64_t)integer->getValue().getZExtValue(), slot);
+		else if (CharacterLiteral *character = dyn_cast<CharacterLiteral>(stmt))
+			bindLiteral(character, (uint64_t)character->getValue(), slot);
+	}
+
+	/// the folder leaves literals of the type they replace, char and folded
+	/// sizeof arithmetic included; an unsupported type leaves the Value empty
+	void bindLiteral(Expr *literal, uint64_t bits, unsigned slot)
+	{
+		UnaryOperation convert = selectLiteral(literal->getType());
+		if (convert == nullptr)
+			return;
+		if (mLiterals.size() <= slot)
+			mLiterals.resize(slot + 1, Value());
+		convert(mLiterals[slot], Value(bits));
+	}
+
+	static bool isInt(QualType type)
+	{
+		const BuiltinType *builtinType = dyn_cast<BuiltinType>(type.getCanonicalType().getTypePtr());
+		return builtinType != NULL && builtinType->getKind() == BuiltinType::Kind::Int;
+	}
+
+	/// return f(...) of a guest function taking int parameters and returning
+	/// what fdecl returns, its callee can run in the returning frame's place
+	void markTailCall(ReturnStmt *ret, FunctionDecl *fdecl)
+	{
+		CallExpr *call = ret->getRetValue() ? dyn_cast<CallExpr>(ret->getRetValue()->IgnoreParens()) : NULL;
+		FunctionDecl *callee = call ? call->getDirectCallee() : NULL;
+		if (callee == NULL || !callee->hasBody() ||
+			callee->getReturnType().getCanonicalType().getTypePtr() != fdecl->getReturnType().getCanonicalType().getTypePtr())
+			return;
+		for (unsigned i = 0; i < callee->getNumParams(); ++i)
+			if (!isInt(callee->getParamDecl(i)->getType()))
+				return;
+		mTailCalls[stmtSlot(call)] = true;
+	}
+
+	void number(Stmt *stmt, const StaticFrame &statics)
+	{
+		if (stmt == NULL)
+			return;
+		if (ReturnStmt *ret = dyn_cast<ReturnStmt>(stmt))
+			mReturns.push_back(ret);
+		if (DeclStmt *declStmt = dyn_cast<DeclStmt>(stmt))
+		{
+			for (DeclStmt::decl_iterator it = declStmt->decl_begin(), ie = declStmt->decl_end(); it != ie; ++it)
+				mVarSlots[*it] = mNumSlots++;
+		}
+		else if (isa<Expr>(stmt))
+		{
+			unsigned slot = mNumSlots++;
+			mExprSlots[stmt] = slot;
+			if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt))
+				resolve(declref, slot, statics);
+			else
+				bindOperation(stmt, slot);
+		}
+
+		for (Stmt *child : stmt->children())
+			number(child, statics);
+	}
+
+public:
+	/// Every global the body refers to must already be bound in statics
+	FunctionLayout(FunctionDecl *fdecl, const StaticFrame &statics) : mNumSlots(0), mFunction(fdecl)
+	{
+		for (FunctionDecl::param_iterator pi = fdecl->param_begin(); pi != fdecl->param_end(); ++pi)
+			mVarSlots[*pi] = mNumSlots++;
+		number(fdecl->getBody(), statics);
+		mVarRefs.resize(mNumSlots, VarRef{VarRef::NONE, 0});
+		mOperations.resize(mNumSlots, Operation());
+		mLiterals.resize(mNumSlots, Value());
+		mTailCalls.resize(mNumSlots, false);
+		for (ReturnStmt *ret : mReturns)
+			markTailCall(ret, fdecl);
+		mReturns.clear();
+	}
+	FunctionDecl *getFunction() const
+	{
+		return mFunction;
+	}
+	unsigned numSlots() const
+	{
+		return mNumSlots;
+	}
+	/// false for globals, which live in the StaticFrame
+	bool hasDecl(const Decl *decl) const
+	{
+		return mVarSlots.count(decl) != 0;
+	}
+	unsigned declSlot(const Decl *decl) const
+	{
+		llvm::DenseMap<const Decl *, unsigned>::const_iterator it = mVarSlots.find(decl);
+		assert(it != mVarSlots.end());
+		return it->second;
+	}
+	bool hasStmt(const Stmt *stmt) const
+	{
+		return mExprSlots.count(stmt) != 0;
+	}
+	unsigned stmtSlot(const Stmt *stmt) const
+	{
+		llvm::DenseMap<const Stmt *, unsigned>::const_iterator it = mExprSlots.find(stmt);
+		assert(it != mExprSlots.end());
+		return it->second;
+	}
+	const VarRef &varRef(unsigned exprSlot) const
+	{
+		assert(mVarRefs[exprSlot].kind != VarRef::NONE);
+		return mVarRefs[exprSlot];
+	}
+	/// null members mean the walker does not support the node's types
+	const Operation &operation(unsigned exprSlot) const
+	{
+		return mOperations[exprSlot];
+	}
+	/// empty if the walker does not support the literal's type
+	const Value &literal(unsigned exprSlot) const
+	{
+		return mLiterals[exprSlot];
+	}
+	bool isTailCall(unsigned exprSlot) const
+	{
+		return mTailCalls[exprSlot];
+	}
+};
@@ -0,0 +1,54 @@
+#include "GuestHeap.h"
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <map>
+
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+GuestHeap::GuestHeap(size_t reserveBytes)
+{
+    // only the pages blocks are carved from get committed
+    void *region = mmap(nullptr, reserveBytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED)
+        llvm::report_fatal_error("cannot reserve the guest heap");
+    mBase = mTop = (char *)region;
+    mEnd = mBase + reserveBytes;
+    std::fill(mFreeLists, mFreeLists + NUM_CLASSES, nullptr);
+}
+
+GuestHeap::~GuestHeap()
+{
+    munmap(mBase, mEnd - mBase);
+}
+
+void GuestHeap::report(llvm::raw_ostream &os) const
+{
+    double fragmentation = mStats.usedBytes ? 1.0 - (double)mStats.liveBytes / mStats.usedBytes : 0.0;
+    os << "guest heap : " << mStats.allocations << " allocations, " << mStats.frees << " frees\n"
+       << "  live " << mStats.liveBytes << " bytes, peak " << mStats.peakBytes << " bytes, carved "
+       << mStats.usedBytes << " bytes, " << llvm::format("%.1f", fragmentation * 100) << "% fragmentation\n";
+}
+
+std::vector<GuestHeap::Leak> GuestHeap::leaks() const
+{
+    // blocks are carved back to back, each one's class gives the next
+    std::map<uint32_t, Leak> sites;
+    for (char *block = mBase; block < mTop; block += (size_t)1 << ((Header *)block)->sizeClass)
+    {
+        const Header *header = (const Header *)block;
+        if (header->size == FREED)
+            continue;
+        Leak &leak = sites.insert(std::make_pair(header->site, Leak{header->site, 0, 0})).first->second;
+        ++leak.blocks;
+        leak.bytes += header->size;
+    }
+    std::vector<Leak> leaks;
+    for (const auto &site : sites)
+        leaks.push_back(site.second);
+    std::stable_sort(leaks.begin(), leaks.end(), [](const Leak &a, const Leak &b) { return a.bytes > b.bytes; });
+    return leaks;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace llvm
+{
+class raw_ostream;
+} // namespace llvm
+
+/// The MALLOC and FREE builtins, shared by both engines.
+/// Every block is carved from one region reserved up front and rounded up to
+/// a power of two size class, header included. FREE pushes a block on the
+/// free list of its class and MALLOC pops from there before carving new
+/// space, so both are O(1). Blocks are never split or merged; the whole
+/// region goes back to the system at once when the heap dies.
+class GuestHeap
+{
+public:
+    struct Stats
+    {
+        /// bytes the guest asked for and has not freed
+        uint64_t liveBytes = 0;
+        uint64_t peakBytes = 0;
+        /// bytes of the region carved into blocks, headers and rounding included
+        uint64_t usedBytes = 0;
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+    };
+    /// blocks still live, grouped by the site they were allocated from
+    struct Leak
+    {
+        uint32_t site;
+        uint64_t blocks;
+        uint64_t bytes;
+    };
+
+    explicit GuestHeap(size_t reserveBytes = (size_t)4 << 30);
+    ~GuestHeap();
+    GuestHeap(const GuestHeap &) = delete;
+    GuestHeap &operator=(const GuestHeap &) = delete;
+
+    /// nullptr for a negative size or once the region is exhausted, like
+    /// malloc. site is the caller's tag for the allocating call, see leaks().
+    void *allocate(int32_t size, uint32_t site = 0)
+    {
+        if (size < 0)
+            return nullptr;
+        unsigned sizeClass = classOf(size);
+        Header *header = mFreeLists[sizeClass];
+        if (header != nullptr)
+            mFreeLists[sizeClass] = nextFree(header);
+        else
+        {
+            size_t bytes = (size_t)1 << sizeClass;
+            if ((size_t)(mEnd - mTop) < bytes)
+                return nullptr;
+            header = (Header *)mTop;
+            mTop += bytes;
+            mStats.usedBytes += bytes;
+        }
+        header->sizeClass = sizeClass;
+        header->size = size;
+        header->site = site;
+        mStats.liveBytes += size;
+        if (mStats.liveBytes > mStats.peakBytes)
+            mStats.peakBytes = mStats.liveBytes;
+        ++mStats.allocations;
+        return header + 1;
+    }
+
+    void free(void *pointer)
+    {
+        if (pointer == nullptr)
+            return;
+        Header *header = (Header *)pointer - 1;
+        assert((char *)header >= mBase && (char *)header < mTop);
+        assert(header->size != FREED);
+        nextFree(header) = mFreeLists[header->sizeClass];
+        mFreeLists[header->sizeClass] = header;
+        mStats.liveBytes -= header->size;
+        header->size = FREED;
+        ++mStats.frees;
+    }
+
+    const Stats &stats() const
+    {
+        return mStats;
+    }
+    /// live, peak and carved bytes, and the share of carved bytes not live
+    void report(llvm::raw_ostream &os) const;
+    /// Walks the carved part of the region block by block, so it costs
+    /// nothing until called. Most bytes first.
+    std::vector<Leak> leaks() const;
+
+private:
+    /// in front of every block, keeps the payload 16 byte aligned
+    struct Header
+    {
+        uint32_t sizeClass;
+        /// FREED while the block is on a free list
+        int32_t size;
+        uint32_t site;
+        uint32_t reserved;
+    };
+    static const int32_t FREED = -1;
+    /// a block of 2^MIN_CLASS bytes holds the header and a free list link
+    static const unsigned MIN_CLASS = 5;
+    static const unsigned NUM_CLASSES = 64;
+
+    char *mBase;
+    char *mTop;
+    char *mEnd;
+    Header *mFreeLists[NUM_CLASSES];
+    Stats mStats;
+
+    static unsigned classOf(int32_t size)
+    {
+        uint64_t bytes = (uint64_t)size + sizeof(Header);
+        unsigned sizeClass = 64 - __builtin_clzll(bytes - 1);
+        return sizeClass < MIN_CLASS ? MIN_CLASS : sizeClass;
+    }
+    /// the link of a free block lives in its payload
+    static Header *&nextFree(Header *header)
+    {
+        return *(Header **)(header + 1);
+    }
+};
@@ -0,0 +1,103 @@
+#include "GuestIO.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <cctype>
+#include <cstdlib>
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+GuestIO::GuestIO(const Options &options) : mOptions(options), mCursor(nullptr), mNextValue(0)
+{
+    int fd = mOptions.output == STDOUT ? STDOUT_FILENO : STDERR_FILENO;
+    mOut.reset(new llvm::raw_fd_ostream(fd, false));
+    if (mOptions.batch)
+        mOut->SetBufferSize(mOptions.bufferSize);
+    else
+        mOut->SetUnbuffered();
+}
+
+GuestIO::~GuestIO()
+{
+    flush();
+}
+
+void GuestIO::flush()
+{
+    mOut->flush();
+}
+
+bool GuestIO::loadInput()
+{
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = llvm::MemoryBuffer::getFileOrSTDIN(mOptions.inputFile);
+    if (!buffer)
+    {
+        llvm::errs() << "cannot read GET input " << mOptions.inputFile << " : " << buffer.getError().message() << "\n";
+        return false;
+    }
+    mInput = std::move(*buffer);
+    mCursor = mInput->getBufferStart();
+    return true;
+}
+
+int32_t GuestIO::get()
+{
+    if (mOptions.inputValues)
+        return mNextValue < mOptions.inputValues->size() ? (*mOptions.inputValues)[mNextValue++] : 0;
+    if (!mOptions.batch)
+    {
+        int32_t val;
+        llvm::errs() << "Please Input an Integer Value : ";
+        scanf("%d", &val);
+        return val;
+    }
+
+    if (!mInput && !loadInput())
+        return 0;
+    const char *end = mInput->getBufferEnd();
+    // running out of input reads as 0
+    while (mCursor < end)
+    {
+        while (mCursor < end && !isdigit(*mCursor) && *mCursor != '-' && *mCursor != '+')
+            ++mCursor;
+        // the buffer is NUL terminated, so strtol stops at the end
+        char *next;
+        long val = strtol(mCursor, &next, 10);
+        if (next != mCursor)
+        {
+            mCursor = next;
+            return (int32_t)val;
+        }
+        // a stray sign, skip it
+        if (mCursor < end)
+            ++mCursor;
+    }
+    return 0;
+}
+
+void GuestIO::print(int32_t val)
+{
+    if (mOptions.outputValues)
+    {
+        mOptions.outputValues->push_back(val);
+        return;
+    }
+    if (mOptions.outputFd >= 0)
+    {
+        // at most PIPE_BUF bytes, a pipe takes the value whole or not at all
+        while (write(mOptions.outputFd, &val, sizeof(val)) < 0 && errno == EINTR)
+            ;
+        return;
+    }
+    *mOut << val;
+}
+
+void GuestIO::rebind(const std::vector<int32_t> *inputValues, int outputFd)
+{
+    mOptions.inputValues = inputValues;
+    mOptions.outputValues = nullptr;
+    mOptions.outputFd = outputFd;
+    mNextValue = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm
+{
+class MemoryBuffer;
+class raw_ostream;
+} // namespace llvm
+
+/// The GET and PRINT builtins, shared by both engines.
+/// Interactive mode prompts before every GET and writes every PRINT through
+/// at once. Batch mode reads all GET values from a file (or stdin) in one go
+/// without prompting and collects PRINT output in a large buffer that is
+/// only written when full or at flush(). An embedder (see Interpreter) may
+/// hand over the GET values and collect the PRINT values in memory or have
+/// them written to a descriptor as they are produced instead.
+class GuestIO
+{
+public:
+    enum Stream
+    {
+        STDOUT,
+        STDERR
+    };
+    struct Options
+    {
+        bool batch;
+        /// GET values in batch mode, "-" is stdin
+        std::string inputFile;
+        Stream output;
+        size_t bufferSize;
+        /// when set, GET reads these in order (0 once they run out) instead
+        /// of the console or inputFile
+        const std::vector<int32_t> *inputValues;
+        /// when set, every PRINT value is appended here instead of written
+        std::vector<int32_t> *outputValues;
+        /// when not -1, every PRINT value is written to this descriptor as a
+        /// raw int32_t at once, a reader gets it even if the guest dies later
+        int outputFd;
+
+        Options() : batch(false), inputFile("-"), output(STDERR), bufferSize(1 << 16), inputValues(nullptr),
+                    outputValues(nullptr), outputFd(-1) {}
+    };
+
+    explicit GuestIO(const Options &options = Options());
+    ~GuestIO();
+    GuestIO(const GuestIO &) = delete;
+    GuestIO &operator=(const GuestIO &) = delete;
+
+    int32_t get();
+    void print(int32_t val);
+    void flush();
+    /// GET reads inputValues from the start and PRINT writes to outputFd
+    /// from now on, for a process forked from a prepared VM (see ForkServer)
+    void rebind(const std::vector<int32_t> *inputValues, int outputFd);
+
+private:
+    Options mOptions;
+    std::unique_ptr<llvm::raw_ostream> mOut;
+    /// whole batch input, read on the first GET
+    std::unique_ptr<llvm::MemoryBuffer> mInput;
+    const char *mCursor;
+    /// next of Options::inputValues
+    size_t mNextValue;
+
+    bool loadInput();
+};
@@ -0,0 +1,103 @@
+#include "Interpreter.h"
+
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "ASTInterpreter.h"
+#include "BytecodeCompiler.h"
+#include "ConstantFolder.h"
+
+std::unique_ptr<CompiledProgram> Interpreter::compile(const std::string &source, std::string *error) const
+{
+    std::string diagnostics;
+    llvm::raw_string_ostream os(diagnostics);
+    TextDiagnosticPrinter printer(os, new DiagnosticOptions());
+    // the same file name and language mode as runToolOnCode
+    std::unique_ptr<ASTUnit> ast = tooling::buildASTFromCodeWithArgs(
+        source, std::vector<std::string>(), "input.cc", "ast-interpreter", std::make_shared<PCHContainerOperations>(),
+        tooling::getClangStripDependencyFileAdjuster(), tooling::FileContentMappings(), &printer);
+    if (!ast || ast->getDiagnostics().hasErrorOccurred())
+    {
+        if (error)
+            *error = os.str();
+        return nullptr;
+    }
+    // the printer dies with this call, the AST may outlive it
+    ast->getDiagnostics().setClient(new IgnoringDiagConsumer(), true);
+
+    ASTContext &context = ast->getASTContext();
+    TranslationUnitDecl *unit = context.getTranslationUnitDecl();
+    if (mOptions.foldConstants)
+        ConstantFolder(context).run(unit);
+
+    std::unique_ptr<CompiledProgram> program(new CompiledProgram(mOptions));
+    Program lowered;
+    if (mOptions.bytecode && BytecodeCompiler(context, mOptions.vectorize).compile(unit, lowered))
+    {
+        program->mBytecode = true;
+        program->mProgram = std::move(lowered);
+        return program;
+    }
+    // the lowering does not cover this program, keep the AST for the walker
+    program->mAST = std::move(ast);
+    return program;
+}
+
+CompiledProgram::CompiledProgram(const Interpreter::Options &options) : mOptions(options), mBytecode(false)
+{
+}
+
+CompiledProgram::~CompiledProgram()
+{
+}
+
+VM::Options CompiledProgram::vmOptions() const
+{
+    VM::Options options = mOptions.vm;
+    options.superinstructionStats = false;
+    options.memoStats = false;
+    options.heapStats = false;
+    options.vectorStats = false;
+    return options;
+}
+
+void CompiledProgram::run(const std::vector<int32_t> &inputs, std::vector<int32_t> &output) const
+{
+    GuestIO::Options ioOptions;
+    ioOptions.inputValues = &inputs;
+    ioOptions.outputValues = &output;
+    GuestIO io(ioOptions);
+    run(io);
+}
+
+void CompiledProgram::run(GuestIO &io) const
+{
+    if (mBytecode)
+    {
+        VM vm(mProgram, io, vmOptions());
+        vm.run();
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mWalkerLock);
+    Environment env;
+    InterpreterVisitor visitor(mAST->getASTContext(), &env);
+    env.setMemoization(mOptions.vm.memoize, false);
+    env.setHeap(mOptions.vm.heapBytes, false);
+    env.initAndRun(mAST->getASTContext().getTranslationUnitDecl(), &visitor, &io);
+}
+
+std::unique_ptr<VM> CompiledProgram::prepareVM(GuestIO &io) const
+{
+    if (!mBytecode)
+        return nullptr;
+    VM::Options options = vmOptions();
+    // a tiered VM would compile again in every run, do it once here
+    if (options.jit == VM::JIT_TIERED)
+        options.jit = VM::JIT_ALWAYS;
+    std::unique_ptr<VM> vm(new VM(mProgram, io, options));
+    vm->compileAll();
+    return vm;
+}
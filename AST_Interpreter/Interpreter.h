@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Bytecode.h"
+#include "VM.h"
+
+namespace clang
+{
+class ASTUnit;
+} // namespace clang
+
+class CompiledProgram;
+
+/// Embedding API of the interpreter, built as the `interpreter` library.
+/// compile() parses, folds and lowers a guest program once; the
+/// CompiledProgram it returns runs main as often as wanted without parsing
+/// again, each run with its own GET values and PRINT sink:
+///
+///     Interpreter interpreter;
+///     std::string error;
+///     std::unique_ptr<CompiledProgram> program = interpreter.compile(source, &error);
+///     std::vector<int32_t> output;
+///     program->run({3, 4}, output);
+class Interpreter
+{
+public:
+    struct Options
+    {
+        /// run on the bytecode VM when the lowering covers the program,
+        /// otherwise (or when false) on the AST walker
+        bool bytecode;
+        bool foldConstants;
+        bool vectorize;
+        /// jit, stack budget, memoization and heap size of every run, the
+        /// report flags are ignored. Native code is compiled per run, for
+        /// many short runs JIT_OFF (or a prepareVM() shared by forking) is
+        /// the cheaper choice. Every run reserves its heap and the stack
+        /// budget, twice under the JIT, so the defaults here are 256 MiB of
+        /// heap and a 64 MiB stack rather than the command line's 4 GiB and
+        /// 1 GiB, which strict overcommit accounting refuses per thread.
+        VM::Options vm;
+
+        Options() : bytecode(true), foldConstants(true), vectorize(true)
+        {
+            vm.stackBudget = (size_t)64 << 20;
+            vm.heapBytes = (size_t)256 << 20;
+        }
+    };
+
+    explicit Interpreter(const Options &options = Options()) : mOptions(options) {}
+
+    /// nullptr if source does not compile, error then holds the diagnostics.
+    /// Not meant to be called from several threads at once.
+    std::unique_ptr<CompiledProgram> compile(const std::string &source, std::string *error = nullptr) const;
+
+private:
+    Options mOptions;
+};
+
+/// A guest program ready to run. Every run gets its own VM (or Environment),
+/// registers, arenas and guest heap, so run() may be called from several
+/// threads at once. Programs the bytecode lowering does not cover run on
+/// the AST walker, whose runs are serialized: clang's ASTContext fills some
+/// of its caches lazily.
+class CompiledProgram
+{
+public:
+    ~CompiledProgram();
+
+    /// Runs main, GET reads inputs in order (0 once they run out) and every
+    /// PRINT value is appended to output
+    void run(const std::vector<int32_t> &inputs, std::vector<int32_t> &output) const;
+    /// Runs main with GET and PRINT going through io
+    void run(GuestIO &io) const;
+    /// A VM for the program bound to io, with every function compiled to
+    /// native code up front unless the options turn the JIT off. Meant for a
+    /// host that forks a process per run (see ForkServer): the children share
+    /// the VM and its code and only run main. nullptr for walker programs.
+    std::unique_ptr<VM> prepareVM(GuestIO &io) const;
+    /// false if runs go to the AST walker
+    bool isBytecode() const
+    {
+        return mBytecode;
+    }
+
+private:
+    friend class Interpreter;
+    explicit CompiledProgram(const Interpreter::Options &options);
+
+    Interpreter::Options mOptions;
+    bool mBytecode;
+
+    /// the VM options of a run, reports off
+    VM::Options vmOptions() const;
+    Program mProgram;
+    /// the parsed program, kept only for the AST walker
+    std::unique_ptr<clang::ASTUnit> mAST;
+    mutable std::mutex mWalkerLock;
+};
@@ -0,0 +1,610 @@
+#include "JIT.h"
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils.h"
+
+#include "VM.h"
+
+// #define DEBUG
+
+// runtime entry points native code calls through constant addresses
+static uint64_t runtimeCall(VM *vm, int32_t index, const Slot *args)
+{
+    return vm->call(index, args).u;
+}
+static int32_t runtimeGet(VM *vm)
+{
+    return vm->input();
+}
+static void runtimePrint(VM *vm, int32_t val)
+{
+    vm->output(val);
+}
+static void *runtimeMalloc(GuestHeap *heap, int32_t size)
+{
+    return heap->allocate(size);
+}
+static void runtimeFree(GuestHeap *heap, void *pointer)
+{
+    heap->free(pointer);
+}
+static bool runtimeVectorLoop(VM *vm, const VectorLoop *loop, Slot *regs)
+{
+    return vm->vectorLoop(*loop, regs);
+}
+static void runtimeStackOverflow()
+{
+    llvm::report_fatal_error("guest stack overflow, raise -stack-budget");
+}
+
+JIT::JIT(VM &vm, const Program &program, char *globals) : mVM(vm), mProgram(program), mGlobals(globals), mModules(0)
+{
+    static std::once_flag targetInitialized;
+    std::call_once(targetInitialized, []() {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+    llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> jit = llvm::orc::LLJITBuilder().create();
+    if (!jit)
+    {
+#ifdef DEBUG
+        llvm::logAllUnhandledErrors(jit.takeError(), llvm::errs(), "jit : ");
+#else
+        llvm::consumeError(jit.takeError());
+#endif
+        return;
+    }
+    mJIT = std::move(*jit);
+}
+
+JIT::~JIT()
+{
+}
+
+namespace
+{
+/// Lowers one CompiledFunction. Every register becomes an i64 stack slot,
+/// mem2reg turns them back into SSA values; int32 registers live in the low
+/// half like they do in a Slot.
+class FunctionLowering
+{
+    llvm::LLVMContext &mContext;
+    llvm::IRBuilder<> mBuilder;
+    llvm::Type *mInt8, *mInt32, *mInt64;
+    std::vector<llvm::AllocaInst *> mRegs;
+
+    llvm::Value *constant(llvm::Type *type, uint64_t val)
+    {
+        return llvm::ConstantInt::get(type, val);
+    }
+    llvm::Value *address(const void *addr, llvm::Type *pointee)
+    {
+        return mBuilder.CreateIntToPtr(constant(mInt64, (uint64_t)(uintptr_t)addr), pointee->getPointerTo());
+    }
+    llvm::Value *getU(int32_t reg)
+    {
+        return mBuilder.CreateLoad(mInt64, mRegs[reg]);
+    }
+    llvm::Value *getI(int32_t reg)
+    {
+        return mBuilder.CreateTrunc(getU(reg), mInt32);
+    }
+    llvm::Value *getP(int32_t reg, llvm::Type *pointee)
+    {
+        return mBuilder.CreateIntToPtr(getU(reg), pointee->getPointerTo());
+    }
+    void setU(int32_t reg, llvm::Value *val)
+    {
+        mBuilder.CreateStore(val, mRegs[reg]);
+    }
+    void setI(int32_t reg, llvm::Value *val)
+    {
+        setU(reg, mBuilder.CreateSExt(val, mInt64));
+    }
+    void setBool(int32_t reg, llvm::Value *cond)
+    {
+        setU(reg, mBuilder.CreateZExt(cond, mInt64));
+    }
+    /// address of element c of the array in register b
+    llvm::Value *element(const Instr &in, llvm::Type *type)
+    {
+        return mBuilder.CreateGEP(type, getP(in.b, type), mBuilder.CreateSExt(getI(in.c), mInt64));
+    }
+
+public:
+    FunctionLowering(llvm::LLVMContext &context) : mContext(context), mBuilder(context)
+    {
+        mInt8 = llvm::Type::getInt8Ty(context);
+        mInt32 = llvm::Type::getInt32Ty(context);
+        mInt64 = llvm::Type::getInt64Ty(context);
+    }
+
+    /// callees maps function indices of the same module to their IR function
+    void lower(const CompiledFunction &fn, llvm::Function *function, const std::map<int32_t, llvm::Function *> &callees,
+               const Program &program, VM *vm, char *globals)
+    {
+        const std::vector<Instr> &code = fn.code;
+
+        // a block starts at every branch target and after every branch
+        std::vector<llvm::BasicBlock *> blocks(code.size() + 1, nullptr);
+        llvm::BasicBlock *entry = llvm::BasicBlock::Create(mContext, "entry", function);
+        for (size_t pc = 0; pc < code.size(); ++pc)
+        {
+            const Instr &in = code[pc];
+            int32_t target = -1;
+            if (in.op == OP_JMP)
+                target = in.a;
+            else if (in.op == OP_JT || in.op == OP_JF || in.op == OP_VLOOP)
+                target = in.b;
+            else if (isCompareBranch(in.op))
+                target = in.c;
+            if (target >= 0 && !blocks[target])
+                blocks[target] = llvm::BasicBlock::Create(mContext, "", function);
+            if ((target >= 0 || in.op == OP_RET || in.op == OP_RETV || in.op == OP_TAILCALL) && !blocks[pc + 1])
+                blocks[pc + 1] = llvm::BasicBlock::Create(mContext, "", function);
+        }
+
+        mBuilder.SetInsertPoint(entry);
+        mRegs.assign(fn.numRegs, nullptr);
+        for (uint32_t r = 0; r < fn.numRegs; ++r)
+        {
+            mRegs[r] = mBuilder.CreateAlloca(mInt64);
+            mBuilder.CreateStore(constant(mInt64, 0), mRegs[r]);
+        }
+        llvm::Function::arg_iterator arg = function->arg_begin();
+        for (uint32_t r = 0; r < fn.numParams; ++r, ++arg)
+            mBuilder.CreateStore(&*arg, mRegs[r]);
+        llvm::Value *arrays = nullptr;
+        if (fn.frameBytes)
+        {
+            llvm::AllocaInst *storage = mBuilder.CreateAlloca(mInt8, constant(mInt32, fn.frameBytes));
+            storage->setAlignment(llvm::Align(16));
+            arrays = storage;
+        }
+        // outgoing arguments of calls that leave the module
+        uint32_t maxArgs = 1;
+        for (const Instr &in : code)
+            if (in.op == OP_CALL || in.op == OP_TAILCALL)
+                maxArgs = std::max(maxArgs, program.functions[in.b].numParams);
+        llvm::Value *outArgs = mBuilder.CreateAlloca(mInt64, constant(mInt32, maxArgs));
+        // the vector kernels read and write registers in the VM's frame layout
+        llvm::Value *vectorRegs = fn.loops.empty() ? nullptr : mBuilder.CreateAlloca(mInt64, constant(mInt32, fn.numRegs));
+
+        llvm::Value *vmAddr = constant(mInt64, (uint64_t)(uintptr_t)vm);
+        llvm::Value *heapAddr = constant(mInt64, (uint64_t)(uintptr_t)&vm->heap());
+        llvm::Type *ptrType = mInt8->getPointerTo();
+
+        // guest recursion in native code must stay inside the VM's stack budget
+        llvm::Value *limit = mBuilder.CreateLoad(mInt64, address(vm->nativeStackLimit(), mInt64));
+        llvm::Value *overflows = mBuilder.CreateICmpULT(mBuilder.CreatePtrToInt(outArgs, mInt64), limit);
+        llvm::BasicBlock *overflow = llvm::BasicBlock::Create(mContext, "overflow", function);
+        llvm::BasicBlock *body = llvm::BasicBlock::Create(mContext, "body", function);
+        mBuilder.CreateCondBr(overflows, overflow, body);
+        mBuilder.SetInsertPoint(overflow);
+        llvm::FunctionType *overflowType = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), false);
+        mBuilder.CreateCall(overflowType, address((void *)&runtimeStackOverflow, overflowType));
+        mBuilder.CreateUnreachable();
+        mBuilder.SetInsertPoint(body);
+
+        // native code keeps counting superinstructions when the VM does
+        uint64_t *fired = vm->fireCounts();
+        for (size_t pc = 0; pc < code.size(); ++pc)
+        {
+            if (blocks[pc])
+            {
+                if (!mBuilder.GetInsertBlock()->getTerminator())
+                    mBuilder.CreateBr(blocks[pc]);
+                mBuilder.SetInsertPoint(blocks[pc]);
+            }
+            const Instr &in = code[pc];
+            if (fired && isSuperinstruction(in.op))
+            {
+                llvm::Value *counter = address(fired + in.op, mInt64);
+                mBuilder.CreateStore(mBuilder.CreateAdd(mBuilder.CreateLoad(mInt64, counter), constant(mInt64, 1)), counter);
+            }
+            switch (in.op)
+            {
+            case OP_NOP:
+                break;
+            case OP_MOV:
+                setU(in.a, getU(in.b));
+                break;
+            case OP_LOADI:
+                setU(in.a, constant(mInt64, (uint64_t)(int64_t)in.b));
+                break;
+
+            case OP_ADD_I:
+                setI(in.a, mBuilder.CreateAdd(getI(in.b), getI(in.c)));
+                break;
+            case OP_SUB_I:
+                setI(in.a, mBuilder.CreateSub(getI(in.b), getI(in.c)));
+                break;
+            case OP_MUL_I:
+                setI(in.a, mBuilder.CreateMul(getI(in.b), getI(in.c)));
+                break;
+            case OP_DIV_I:
+                setI(in.a, mBuilder.CreateSDiv(getI(in.b), getI(in.c)));
+                break;
+            case OP_REM_I:
+                setI(in.a, mBuilder.CreateSRem(getI(in.b), getI(in.c)));
+                break;
+            case OP_NEG_I:
+                setI(in.a, mBuilder.CreateNeg(getI(in.b)));
+                break;
+            case OP_NOT_B:
+                setBool(in.a, mBuilder.CreateICmpEQ(getI(in.b), constant(mInt32, 0)));
+                break;
+            case OP_NEZ_I:
+                setBool(in.a, mBuilder.CreateICmpNE(getI(in.b), constant(mInt32, 0)));
+                break;
+            case OP_NEZ_P:
+                setBool(in.a, mBuilder.CreateICmpNE(getU(in.b), constant(mInt64, 0)));
+                break;
+
+            case OP_ADD_U:
+                setU(in.a, mBuilder.CreateAdd(getU(in.b), getU(in.c)));
+                break;
+            case OP_SUB_U:
+                setU(in.a, mBuilder.CreateSub(getU(in.b), getU(in.c)));
+                break;
+            case OP_MUL_U:
+                setU(in.a, mBuilder.CreateMul(getU(in.b), getU(in.c)));
+                break;
+            case OP_DIV_U:
+                setU(in.a, mBuilder.CreateUDiv(getU(in.b), getU(in.c)));
+                break;
+
+            case OP_EQ_I:
+                setBool(in.a, mBuilder.CreateICmpEQ(getI(in.b), getI(in.c)));
+                break;
+            case OP_NE_I:
+                setBool(in.a, mBuilder.CreateICmpNE(getI(in.b), getI(in.c)));
+                break;
+            case OP_LT_I:
+                setBool(in.a, mBuilder.CreateICmpSLT(getI(in.b), getI(in.c)));
+                break;
+            case OP_GT_I:
+                setBool(in.a, mBuilder.CreateICmpSGT(getI(in.b), getI(in.c)));
+                break;
+            case OP_LE_I:
+                setBool(in.a, mBuilder.CreateICmpSLE(getI(in.b), getI(in.c)));
+                break;
+            case OP_GE_I:
+                setBool(in.a, mBuilder.CreateICmpSGE(getI(in.b), getI(in.c)));
+                break;
+            case OP_EQ_U:
+                setBool(in.a, mBuilder.CreateICmpEQ(getU(in.b), getU(in.c)));
+                break;
+            case OP_NE_U:
+                setBool(in.a, mBuilder.CreateICmpNE(getU(in.b), getU(in.c)));
+                break;
+            case OP_LT_U:
+                setBool(in.a, mBuilder.CreateICmpULT(getU(in.b), getU(in.c)));
+                break;
+            case OP_GT_U:
+                setBool(in.a, mBuilder.CreateICmpUGT(getU(in.b), getU(in.c)));
+                break;
+            case OP_LE_U:
+                setBool(in.a, mBuilder.CreateICmpULE(getU(in.b), getU(in.c)));
+                break;
+            case OP_GE_U:
+                setBool(in.a, mBuilder.CreateICmpUGE(getU(in.b), getU(in.c)));
+                break;
+
+            case OP_I2U:
+                setU(in.a, mBuilder.CreateSExt(getI(in.b), mInt64));
+                break;
+            case OP_U2I:
+                setI(in.a, mBuilder.CreateTrunc(getU(in.b), mInt32));
+                break;
+            case OP_I2C:
+                setI(in.a, mBuilder.CreateSExt(mBuilder.CreateTrunc(getI(in.b), mInt8), mInt32));
+                break;
+            case OP_PADD:
+            case OP_PSUB:
+            {
+                llvm::Value *offset = mBuilder.CreateMul(mBuilder.CreateSExt(getI(in.c), mInt64), constant(mInt64, in.scale));
+                if (in.op == OP_PSUB)
+                    offset = mBuilder.CreateNeg(offset);
+                setU(in.a, mBuilder.CreatePtrToInt(mBuilder.CreateGEP(mInt8, getP(in.b, mInt8), offset), mInt64));
+                break;
+            }
+
+            case OP_LOAD8:
+                setI(in.a, mBuilder.CreateSExt(mBuilder.CreateLoad(mInt8, getP(in.b, mInt8)), mInt32));
+                break;
+            case OP_LOAD32:
+                setI(in.a, mBuilder.CreateLoad(mInt32, getP(in.b, mInt32)));
+                break;
+            case OP_LOAD64:
+                setU(in.a, mBuilder.CreateLoad(mInt64, getP(in.b, mInt64)));
+                break;
+            case OP_STORE8:
+                mBuilder.CreateStore(mBuilder.CreateTrunc(getI(in.a), mInt8), getP(in.b, mInt8));
+                break;
+            case OP_STORE32:
+                mBuilder.CreateStore(getI(in.a), getP(in.b, mInt32));
+                break;
+            case OP_STORE64:
+                mBuilder.CreateStore(getU(in.a), getP(in.b, mInt64));
+                break;
+            case OP_LOADG8:
+                setI(in.a, mBuilder.CreateSExt(mBuilder.CreateLoad(mInt8, address(globals + in.b, mInt8)), mInt32));
+                break;
+            case OP_LOADG32:
+                setI(in.a, mBuilder.CreateLoad(mInt32, address(globals + in.b, mInt32)));
+                break;
+            case OP_LOADG64:
+                setU(in.a, mBuilder.CreateLoad(mInt64, address(globals + in.b, mInt64)));
+                break;
+            case OP_STOREG8:
+                mBuilder.CreateStore(mBuilder.CreateTrunc(getI(in.a), mInt8), address(globals + in.b, mInt8));
+                break;
+            case OP_STOREG32:
+                mBuilder.CreateStore(getI(in.a), address(globals + in.b, mInt32));
+                break;
+            case OP_STOREG64:
+                mBuilder.CreateStore(getU(in.a), address(globals + in.b, mInt64));
+                break;
+            case OP_ADDRG:
+                setU(in.a, constant(mInt64, (uint64_t)(uintptr_t)(globals + in.b)));
+                break;
+            case OP_ADDRL:
+                setU(in.a, mBuilder.CreatePtrToInt(mBuilder.CreateGEP(mInt8, arrays, constant(mInt64, in.b)), mInt64));
+                break;
+
+            case OP_JMP:
+                mBuilder.CreateBr(blocks[in.a]);
+                break;
+            case OP_JT:
+            case OP_JF:
+            {
+                llvm::Value *cond = mBuilder.CreateICmpNE(getI(in.a), constant(mInt32, 0));
+                if (in.op == OP_JT)
+                    mBuilder.CreateCondBr(cond, blocks[in.b], blocks[pc + 1]);
+                else
+                    mBuilder.CreateCondBr(cond, blocks[pc + 1], blocks[in.b]);
+                break;
+            }
+
+            case OP_CALL:
+            case OP_TAILCALL:
+            {
+                const CompiledFunction &callee = program.functions[in.b];
+                llvm::Value *ret;
+                std::map<int32_t, llvm::Function *>::const_iterator direct = callees.find(in.b);
+                // memoized calls go through the VM, which consults the table
+                if (direct != callees.end() && !vm->memoizes(in.b))
+                {
+                    std::vector<llvm::Value *> args;
+                    for (uint32_t i = 0; i < callee.numParams; ++i)
+                        args.push_back(getU(in.c + i));
+                    llvm::CallInst *call = mBuilder.CreateCall(direct->second->getFunctionType(), direct->second, args);
+                    // lets tail call elimination turn self recursion into a loop
+                    call->setTailCall(in.op == OP_TAILCALL);
+                    ret = call;
+                }
+                else
+                {
+                    for (uint32_t i = 0; i < callee.numParams; ++i)
+                        mBuilder.CreateStore(getU(in.c + i), mBuilder.CreateGEP(mInt64, outArgs, constant(mInt32, i)));
+                    llvm::FunctionType *type = llvm::FunctionType::get(mInt64, {mInt64, mInt32, mInt64->getPointerTo()}, false);
+                    ret = mBuilder.CreateCall(type, address((void *)&runtimeCall, type),
+                                              {vmAddr, constant(mInt32, in.b), outArgs});
+                }
+                if (in.op == OP_TAILCALL)
+                    mBuilder.CreateRet(ret);
+                else if (in.a >= 0)
+                    setU(in.a, ret);
+                break;
+            }
+            case OP_RET:
+                mBuilder.CreateRet(getU(in.a));
+                break;
+            case OP_RETV:
+                mBuilder.CreateRet(constant(mInt64, 0));
+                break;
+
+            case OP_GET:
+            {
+                llvm::FunctionType *type = llvm::FunctionType::get(mInt32, {mInt64}, false);
+                setI(in.a, mBuilder.CreateCall(type, address((void *)&runtimeGet, type), {vmAddr}));
+                break;
+            }
+            case OP_PRINT:
+            {
+                llvm::FunctionType *type = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {mInt64, mInt32}, false);
+                mBuilder.CreateCall(type, address((void *)&runtimePrint, type), {vmAddr, getI(in.a)});
+                break;
+            }
+            case OP_MALLOC:
+            {
+                llvm::FunctionType *type = llvm::FunctionType::get(ptrType, {mInt64, mInt32}, false);
+                llvm::Value *pointer = mBuilder.CreateCall(type, address((void *)&runtimeMalloc, type), {heapAddr, getI(in.b)});
+                setU(in.a, mBuilder.CreatePtrToInt(pointer, mInt64));
+                break;
+            }
+            case OP_FREE:
+            {
+                llvm::FunctionType *type = llvm::FunctionType::get(llvm::Type::getVoidTy(mContext), {mInt64, ptrType}, false);
+                mBuilder.CreateCall(type, address((void *)&runtimeFree, type), {heapAddr, getP(in.a, mInt8)});
+                break;
+            }
+
+            case OP_VLOOP:
+            {
+                const VectorLoop &loop = fn.loops[in.a];
+                std::vector<int32_t> used = {loop.counter, loop.dst};
+                for (const VectorOperand *operand : {&loop.limit, &loop.lhs, &loop.rhs})
+                    if (operand->kind != VectorOperand::IMM)
+                        used.push_back(operand->value);
+                for (int32_t reg : used)
+                    mBuilder.CreateStore(getU(reg), mBuilder.CreateGEP(mInt64, vectorRegs, constant(mInt32, reg)));
+                llvm::FunctionType *type = llvm::FunctionType::get(mInt8, {mInt64, mInt64, mInt64->getPointerTo()}, false);
+                llvm::Value *ran = mBuilder.CreateCall(type, address((void *)&runtimeVectorLoop, type),
+                                                       {vmAddr, constant(mInt64, (uint64_t)(uintptr_t)&loop), vectorRegs});
+                ran = mBuilder.CreateICmpNE(ran, constant(mInt8, 0));
+                // only the counter and a sum's accumulator change
+                setU(loop.counter, mBuilder.CreateLoad(mInt64, mBuilder.CreateGEP(mInt64, vectorRegs, constant(mInt32, loop.counter))));
+                if (loop.kind == VectorLoop::SUM)
+                    setU(loop.dst, mBuilder.CreateLoad(mInt64, mBuilder.CreateGEP(mInt64, vectorRegs, constant(mInt32, loop.dst))));
+                mBuilder.CreateCondBr(ran, blocks[in.b], blocks[pc + 1]);
+                break;
+            }
+
+            case OP_ADDK_I:
+                setI(in.a, mBuilder.CreateAdd(getI(in.b), constant(mInt32, (uint32_t)in.c)));
+                break;
+            case OP_JEQ_I:
+            case OP_JNE_I:
+            case OP_JLT_I:
+            case OP_JGT_I:
+            case OP_JLE_I:
+            case OP_JGE_I:
+            case OP_JEQK_I:
+            case OP_JNEK_I:
+            case OP_JLTK_I:
+            case OP_JGTK_I:
+            case OP_JLEK_I:
+            case OP_JGEK_I:
+            {
+                static const llvm::CmpInst::Predicate predicates[] = {
+                    llvm::CmpInst::ICMP_EQ, llvm::CmpInst::ICMP_NE, llvm::CmpInst::ICMP_SLT,
+                    llvm::CmpInst::ICMP_SGT, llvm::CmpInst::ICMP_SLE, llvm::CmpInst::ICMP_SGE};
+                bool immediate = in.op >= OP_JEQK_I;
+                llvm::Value *rhs = immediate ? constant(mInt32, (uint32_t)in.b) : getI(in.b);
+                llvm::Value *cond = mBuilder.CreateICmp(predicates[in.op - (immediate ? OP_JEQK_I : OP_JEQ_I)], getI(in.a), rhs);
+                mBuilder.CreateCondBr(cond, blocks[in.c], blocks[pc + 1]);
+                break;
+            }
+            case OP_LOADX8:
+                setI(in.a, mBuilder.CreateSExt(mBuilder.CreateLoad(mInt8, element(in, mInt8)), mInt32));
+                break;
+            case OP_LOADX32:
+                setI(in.a, mBuilder.CreateLoad(mInt32, element(in, mInt32)));
+                break;
+            case OP_LOADX64:
+                setU(in.a, mBuilder.CreateLoad(mInt64, element(in, mInt64)));
+                break;
+            case OP_STOREX8:
+                mBuilder.CreateStore(mBuilder.CreateTrunc(getI(in.a), mInt8), element(in, mInt8));
+                break;
+            case OP_STOREX32:
+                mBuilder.CreateStore(getI(in.a), element(in, mInt32));
+                break;
+            case OP_STOREX64:
+                mBuilder.CreateStore(getU(in.a), element(in, mInt64));
+                break;
+
+            default:
+                assert(0);
+            }
+        }
+        // falling off the end, including the block opened after a trailing return
+        if (blocks[code.size()] && !mBuilder.GetInsertBlock()->getTerminator())
+            mBuilder.CreateBr(blocks[code.size()]);
+        if (blocks[code.size()])
+            mBuilder.SetInsertPoint(blocks[code.size()]);
+        if (!mBuilder.GetInsertBlock()->getTerminator())
+            mBuilder.CreateRet(constant(mInt64, 0));
+    }
+};
+} // namespace
+
+bool JIT::compile(const std::vector<int32_t> &functions, std::vector<NativeFunction> &out)
+{
+    if (!mJIT)
+        return false;
+
+    std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+    std::unique_ptr<llvm::Module> module(new llvm::Module("guest" + std::to_string(mModules++), *context));
+    module->setDataLayout(mJIT->getDataLayout());
+    llvm::Type *int64 = llvm::Type::getInt64Ty(*context);
+
+    // declare first, so functions of the batch can call each other directly
+    std::map<int32_t, llvm::Function *> callees;
+    for (int32_t index : functions)
+    {
+        std::vector<llvm::Type *> params(mProgram.functions[index].numParams, int64);
+        llvm::FunctionType *type = llvm::FunctionType::get(int64, params, false);
+        callees[index] = llvm::Function::Create(type, llvm::Function::InternalLinkage, "guest" + std::to_string(index), module.get());
+    }
+
+    FunctionLowering lowering(*context);
+    for (int32_t index : functions)
+    {
+        llvm::Function *function = callees[index];
+        lowering.lower(mProgram.functions[index], function, callees, mProgram, &mVM, mGlobals);
+
+        // entry used by the VM, unpacks the argument slots
+        llvm::FunctionType *type = llvm::FunctionType::get(int64, {int64->getPointerTo()}, false);
+        llvm::Function *entry = llvm::Function::Create(type, llvm::Function::ExternalLinkage,
+                                                       "guest" + std::to_string(index) + ".entry", module.get());
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(*context, "entry", entry));
+        std::vector<llvm::Value *> args;
+        for (uint32_t i = 0; i < mProgram.functions[index].numParams; ++i)
+            args.push_back(builder.CreateLoad(int64, builder.CreateGEP(int64, &*entry->arg_begin(), builder.getInt32(i))));
+        builder.CreateRet(builder.CreateCall(function->getFunctionType(), function, args));
+    }
+
+    for (llvm::Function &function : *module)
+    {
+        if (llvm::verifyFunction(function, &llvm::errs()))
+        {
+#ifdef DEBUG
+            function.print(llvm::errs());
+#endif
+            return false;
+        }
+    }
+
+    llvm::legacy::FunctionPassManager passes(module.get());
+    passes.add(llvm::createPromoteMemoryToRegisterPass());
+    passes.add(llvm::createInstructionCombiningPass());
+    passes.add(llvm::createReassociatePass());
+    passes.add(llvm::createGVNPass());
+    passes.add(llvm::createCFGSimplificationPass());
+    passes.add(llvm::createTailCallEliminationPass());
+    passes.doInitialization();
+    for (llvm::Function &function : *module)
+        passes.run(function);
+    passes.doFinalization();
+#ifdef DEBUG
+    module->print(llvm::errs(), nullptr);
+#endif
+
+    llvm::Error error = mJIT->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)));
+    if (error)
+    {
+        llvm::consumeError(std::move(error));
+        return false;
+    }
+    std::vector<NativeFunction> entries;
+    for (int32_t index : functions)
+    {
+        llvm::Expected<llvm::JITEvaluatedSymbol> symbol = mJIT->lookup("guest" + std::to_string(index) + ".entry");
+        if (!symbol)
+        {
+            llvm::consumeError(symbol.takeError());
+            return false;
+        }
+        entries.push_back((NativeFunction)symbol->getAddress());
+    }
+    out.swap(entries);
+    return true;
+}
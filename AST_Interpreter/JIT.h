@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Bytecode.h"
+
+namespace llvm
+{
+namespace orc
+{
+class LLJIT;
+}
+} // namespace llvm
+
+class VM;
+
+/// Native tier of the VM: lowers CompiledFunctions to LLVM IR and compiles
+/// them in process with ORC.
+/// Calls between functions of the same compile() batch are direct, any other
+/// call goes back through VM::call, which picks native code when the callee
+/// has some. GET / PRINT / MALLOC / FREE become calls into the runtime.
+class JIT
+{
+public:
+    /// Entry point of a compiled function, args holds numParams slots
+    typedef uint64_t (*NativeFunction)(const Slot *args);
+
+    JIT(VM &vm, const Program &program, char *globals);
+    ~JIT();
+    /// false if the host target could not be set up
+    bool isValid() const
+    {
+        return mJIT != nullptr;
+    }
+    /// Compile the given functions as one module, out receives the entry of
+    /// each in order. Returns false and leaves out untouched on failure.
+    bool compile(const std::vector<int32_t> &functions, std::vector<NativeFunction> &out);
+
+private:
+    VM &mVM;
+    const Program &mProgram;
+    char *mGlobals;
+    std::unique_ptr<llvm::orc::LLJIT> mJIT;
+    unsigned mModules;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// Results of pure guest functions keyed by (function, argument values).
+/// The table is direct mapped and never grows: a call landing on an entry
+/// of another key evicts it, so memory stays bounded however many distinct
+/// calls a program makes. Both engines share it, functions are identified
+/// by the caller's own index.
+class MemoTable
+{
+public:
+    /// functions with more parameters are never memoized
+    static const unsigned MAX_ARGS = 4;
+
+    struct Entry
+    {
+        /// bumped whenever the entry is claimed for a new key
+        uint64_t stamp = 0;
+        int32_t function = -1;
+        bool valid = false;
+        int32_t args[MAX_ARGS];
+        int32_t result = 0;
+    };
+    /// The entry a missed call reserved. Calls made while it runs may evict
+    /// the entry again, complete() notices that from the stamp.
+    struct Ticket
+    {
+        Entry *entry = nullptr;
+        uint64_t stamp = 0;
+    };
+    struct Counters
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    /// capacity must be a power of two
+    explicit MemoTable(size_t numFunctions, size_t capacity = (size_t)1 << 16)
+        : mEntries(capacity), mCounters(numFunctions), mStamp(0) {}
+
+    /// true and result set on a hit, otherwise ticket reserves the entry
+    bool lookup(int32_t function, const int32_t *args, unsigned numArgs, int32_t &result, Ticket &ticket)
+    {
+        Entry &entry = mEntries[hash(function, args, numArgs) & (mEntries.size() - 1)];
+        if (entry.valid && entry.function == function && std::equal(args, args + numArgs, entry.args))
+        {
+            ++mCounters[function].hits;
+            result = entry.result;
+            return true;
+        }
+        ++mCounters[function].misses;
+        entry.stamp = ++mStamp;
+        entry.function = function;
+        entry.valid = false;
+        std::copy(args, args + numArgs, entry.args);
+        ticket.entry = &entry;
+        ticket.stamp = entry.stamp;
+        return false;
+    }
+
+    void complete(const Ticket &ticket, int32_t result)
+    {
+        if (ticket.entry == nullptr || ticket.entry->stamp != ticket.stamp)
+            return;
+        ticket.entry->result = result;
+        ticket.entry->valid = true;
+    }
+
+    const Counters &counters(int32_t function) const
+    {
+        return mCounters[function];
+    }
+
+    /// hit / miss table of the functions that were called at least once
+    void report(llvm::raw_ostream &os, const std::vector<std::string> &names) const
+    {
+        os << "memoized function             hits          misses\n";
+        for (size_t i = 0; i < mCounters.size(); ++i)
+        {
+            if (mCounters[i].hits == 0 && mCounters[i].misses == 0)
+                continue;
+            os << llvm::left_justify(names[i], 20) << llvm::format_decimal(mCounters[i].hits, 16)
+               << llvm::format_decimal(mCounters[i].misses, 16) << "\n";
+        }
+    }
+
+private:
+    std::vector<Entry> mEntries;
+    std::vector<Counters> mCounters;
+    uint64_t mStamp;
+
+    static uint64_t hash(int32_t function, const int32_t *args, unsigned numArgs)
+    {
+        uint64_t h = (uint64_t)function * 0x9E3779B97F4A7C15ull;
+        for (unsigned i = 0; i < numArgs; ++i)
+            h = (h ^ (uint32_t)args[i]) * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+};
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <functional>
+#include <type_traits>
+
+#include "clang/AST/Expr.h"
+#include "Value.h"
+
+using namespace clang;
+
+/// Handlers of the AST walker's operator nodes. Every handler is a template
+/// instantiated per (operation, host type), so executing a node is a single
+/// indirect call; the type and opcode tests happen once, when select*()
+/// binds the handler to the node (see FunctionLayout).
+/// Supporting another integer type means a ValueTraits specialization and a
+/// case in withValueType, every operation picks it up from there.
+typedef void (*BinaryOperation)(Value &result, const Value &lhs, const Value &rhs);
+typedef void (*UnaryOperation)(Value &result, const Value &operand);
+
+/// The handler bound to one expression slot, which member is set depends on the node
+union Operation
+{
+	BinaryOperation binary;
+	UnaryOperation unary;
+};
+
+template <typename T>
+struct ValueTraits;
+/// char is held as an INT32 Value, only its storage is a single byte
+template <>
+struct ValueTraits<int8_t>
+{
+	static int8_t get(const Value &val) { return (int8_t)val.getInt32(); }
+};
+template <>
+struct ValueTraits<int32_t>
+{
+	static int32_t get(const Value &val) { return val.getInt32(); }
+};
+template <>
+struct ValueTraits<uint64_t>
+{
+	static uint64_t get(const Value &val) { return val.getUInt64(); }
+};
+template <>
+struct ValueTraits<bool>
+{
+	static bool get(const Value &val) { return val.getBool(); }
+};
+template <>
+struct ValueTraits<void *>
+{
+	static void *get(const Value &val) { return val.getPointer(); }
+};
+
+namespace operations
+{
+template <typename T>
+struct TypeTag
+{
+	typedef T type;
+};
+
+/// Calls f(TypeTag<T>()) with T the host type holding values of qualType,
+/// returns a null handler for types the walker does not represent.
+template <typename F>
+auto withValueType(QualType qualType, F f) -> decltype(f(TypeTag<int32_t>()))
+{
+	const Type *type = qualType.getCanonicalType().getTypePtr();
+	if (const BuiltinType *builtinType = dyn_cast<BuiltinType>(type))
+	{
+		switch (builtinType->getKind())
+		{
+		case BuiltinType::Kind::Char_S:
+		case BuiltinType::Kind::SChar:
+			return f(TypeTag<int8_t>());
+		case BuiltinType::Kind::Int:
+			return f(TypeTag<int32_t>());
+		case BuiltinType::Kind::ULong:
+			return f(TypeTag<uint64_t>());
+		case BuiltinType::Kind::Bool:
+			return f(TypeTag<bool>());
+		default:
+			break;
+		}
+	}
+	else if (type->isPointerType() && !type->isFunctionPointerType())
+		return f(TypeTag<void *>());
+	return nullptr;
+}
+
+template <typename T, typename Op>
+void arithmetic(Value &result, const Value &lhs, const Value &rhs)
+{
+	result = Value(T(Op()(ValueTraits<T>::get(lhs), ValueTraits<T>::get(rhs))));
+}
+
+template <typename T, typename Op>
+void compare(Value &result, const Value &lhs, const Value &rhs)
+{
+	result = Value(bool(Op()(ValueTraits<T>::get(lhs), ValueTraits<T>::get(rhs))));
+}
+
+/// lhs holds the address of the assigned variable or element
+template <typename T>
+void assign(Value &result, const Value &lhs, const Value &rhs)
+{
+	T val = ValueTraits<T>::get(rhs);
+	*(T *)lhs.getPointer() = val;
+	result = Value(val);
+}
+
+/// pointer +/- int, T is the pointee
+template <typename T, int Sign>
+void pointerOffset(Value &result, const Value &lhs, const Value &rhs)
+{
+	result = Value((void *)((T *)lhs.getPointer() + Sign * (int64_t)rhs.getInt32()));
+}
+
+template <typename T>
+void load(Value &result, const Value &address)
+{
+	result = Value(*(T *)address.getPointer());
+}
+
+template <typename From, typename To>
+void convert(Value &result, const Value &operand)
+{
+	result = Value(To(ValueTraits<From>::get(operand)));
+}
+
+template <typename T>
+void negate(Value &result, const Value &operand)
+{
+	result = Value(T(0 - ValueTraits<T>::get(operand)));
+}
+
+inline void logicalNot(Value &result, const Value &operand)
+{
+	result = Value(!operand.getBool());
+}
+
+/// *p, array decay and pointer casts: the value is the pointer itself
+inline void passPointer(Value &result, const Value &operand)
+{
+	result = Value(operand.getPointer());
+}
+
+inline void nullPointer(Value &result, const Value &operand)
+{
+	result = Value((void *)nullptr);
+}
+
+/// callee casts, the call resolves the callee from the AST
+inline void nothing(Value &result, const Value &operand)
+{
+}
+
+template <typename T>
+BinaryOperation arithmeticFor(BinaryOperator::Opcode opcode, std::true_type /* integral */)
+{
+	switch (opcode)
+	{
+	case BinaryOperator::Opcode::BO_Add:
+		return &arithmetic<T, std::plus<T>>;
+	case BinaryOperator::Opcode::BO_Sub:
+		return &arithmetic<T, std::minus<T>>;
+	case BinaryOperator::Opcode::BO_Mul:
+		return &arithmetic<T, std::multiplies<T>>;
+	case BinaryOperator::Opcode::BO_Div:
+		return &arithmetic<T, std::divides<T>>;
+	case BinaryOperator::Opcode::BO_Rem:
+		return &arithmetic<T, std::modulus<T>>;
+	default:
+		return nullptr;
+	}
+}
+
+template <typename T>
+BinaryOperation arithmeticFor(BinaryOperator::Opcode opcode, std::false_type)
+{
+	return nullptr;
+}
+
+template <typename T>
+BinaryOperation comparisonFor(BinaryOperator::Opcode opcode)
+{
+	switch (opcode)
+	{
+	case BinaryOperator::Opcode::BO_EQ:
+		return &compare<T, std::equal_to<T>>;
+	case BinaryOperator::Opcode::BO_NE:
+		return &compare<T, std::not_equal_to<T>>;
+	case BinaryOperator::Opcode::BO_LT:
+		return &compare<T, std::less<T>>;
+	case BinaryOperator::Opcode::BO_GT:
+		return &compare<T, std::greater<T>>;
+	case BinaryOperator::Opcode::BO_LE:
+		return &compare<T, std::less_equal<T>>;
+	case BinaryOperator::Opcode::BO_GE:
+		return &compare<T, std::greater_equal<T>>;
+	default:
+		return nullptr;
+	}
+}
+
+/// integral conversions, and any scalar to bool
+template <typename From, typename To>
+UnaryOperation conversionFor(std::true_type /* convertible */)
+{
+	return &convert<From, To>;
+}
+
+template <typename From, typename To>
+UnaryOperation conversionFor(std::false_type)
+{
+	return nullptr;
+}
+
+template <typename T>
+UnaryOperation negateFor(std::true_type /* integral */)
+{
+	return &negate<T>;
+}
+
+template <typename T>
+UnaryOperation negateFor(std::false_type)
+{
+	return nullptr;
+}
+} // namespace operations
+
+inline BinaryOperation selectBinary(BinaryOperator *bop)
+{
+	using namespace operations;
+	BinaryOperator::Opcode opcode = bop->getOpcode();
+	if (bop->isComparisonOp())
+		return withValueType(bop->getLHS()->getType(), [opcode](auto tag) {
+			return comparisonFor<typename decltype(tag)::type>(opcode);
+		});
+	if (opcode == BinaryOperator::Opcode::BO_Assign)
+		return withValueType(bop->getType(), [](auto tag) -> BinaryOperation {
+			return &assign<typename decltype(tag)::type>;
+		});
+	if (bop->getType()->isPointerType() && bop->getLHS()->getType()->isPointerType() &&
+		(opcode == BinaryOperator::Opcode::BO_Add || opcode == BinaryOperator::Opcode::BO_Sub))
+	{
+		bool add = opcode == BinaryOperator::Opcode::BO_Add;
+		return withValueType(bop->getType()->getPointeeType(), [add](auto tag) -> BinaryOperation {
+			typedef typename decltype(tag)::type T;
+			return add ? &pointerOffset<T, 1> : &pointerOffset<T, -1>;
+		});
+	}
+	return withValueType(bop->getType(), [opcode](auto tag) {
+		typedef typename decltype(tag)::type T;
+		return arithmeticFor<T>(opcode, std::is_integral<T>());
+	});
+}
+
+inline UnaryOperation selectCast(CastExpr *castExpr)
+{
+	using namespace operations;
+	QualType from = castExpr->getSubExpr()->getType();
+	QualType to = castExpr->getType();
+	switch (castExpr->getCastKind())
+	{
+	case CastKind::CK_LValueToRValue:
+		return withValueType(to, [](auto tag) -> UnaryOperation {
+			return &load<typename decltype(tag)::type>;
+		});
+	case CastKind::CK_IntegralCast:
+	case CastKind::CK_IntegralToBoolean:
+	case CastKind::CK_PointerToBoolean:
+		return withValueType(from, [to](auto fromTag) {
+			typedef typename decltype(fromTag)::type From;
+			return withValueType(to, [](auto toTag) {
+				typedef typename decltype(toTag)::type To;
+				return conversionFor<From, To>(std::integral_constant<bool, std::is_integral<To>::value &&
+																				(std::is_integral<From>::value || std::is_same<To, bool>::value)>());
+			});
+		});
+	case CastKind::CK_NullToPointer:
+		return &nullPointer;
+	case CastKind::CK_FunctionToPointerDecay:
+		return &nothing;
+	default:
+		// array decay, bit and no-op casts between pointers
+		if (to->isPointerType() && (from->isPointerType() || from->isArrayType()))
+			return &passPointer;
+		return nullptr;
+	}
+}
+
+/// Integer and character literals, folded ones of any integer type included:
+/// the handler turns the literal's bits, held as UINT64, into a Value of type
+inline UnaryOperation selectLiteral(QualType type)
+{
+	using namespace operations;
+	return withValueType(type, [](auto tag) {
+		typedef typename decltype(tag)::type T;
+		return conversionFor<uint64_t, T>(std::integral_constant<bool, std::is_integral<T>::value>());
+	});
+}
+
+/// base[index] is the address base + index * sizeof(T), T the element type
+inline BinaryOperation selectSubscript(ArraySubscriptExpr *subscript)
+{
+	using namespace operations;
+	const BuiltinType *indexType = dyn_cast<BuiltinType>(subscript->getIdx()->getType().getCanonicalType().getTypePtr());
+	if (indexType == NULL || indexType->getKind() != BuiltinType::Kind::Int)
+		return nullptr;
+	return withValueType(subscript->getType(), [](auto tag) -> BinaryOperation {
+		return &pointerOffset<typename decltype(tag)::type, 1>;
+	});
+}
+
+inline UnaryOperation selectUnary(UnaryOperator *uop)
+{
+	using namespace operations;
+	switch (uop->getOpcode())
+	{
+	case UnaryOperator::Opcode::UO_Minus:
+		return withValueType(uop->getType(), [](auto tag) {
+			typedef typename decltype(tag)::type T;
+			return negateFor<T>(std::is_integral<T>());
+		});
+	case UnaryOperator::Opcode::UO_LNot:
+		return uop->getSubExpr()->getType()->isBooleanType() ? &logicalNot : nullptr;
+	case UnaryOperator::Opcode::UO_Deref:
+		// the node's value is the address of the pointee
+		return &passPointer;
+	default:
+		return nullptr;
+	}
+}
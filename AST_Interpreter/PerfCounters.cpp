@@ -0,0 +1,201 @@
+#include "PerfCounters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "llvm/Support/Format.h"
+
+namespace
+{
+struct EventKind
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+const EventKind EVENTS[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1D misses", PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+const unsigned CYCLES = 0;
+const unsigned INSTRUCTIONS = 1;
+
+/// counts this thread on any CPU, user space only so an unprivileged
+/// process may open it
+int openEvent(const EventKind &kind, int groupFd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = kind.type;
+    attr.config = kind.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // the times tell how long the group was on the PMU when it is multiplexed
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+} // namespace
+
+PerfCounters::PerfCounters() : mLeader(-1), mLast(), mLastEnabled(0), mLastRunning(0), mLastTime(Clock::now())
+{
+    static_assert(sizeof(EVENTS) / sizeof(EVENTS[0]) == MAX_EVENTS, "one total per event");
+    for (unsigned i = 0; i < MAX_EVENTS; ++i)
+    {
+        int fd = openEvent(EVENTS[i], mLeader);
+        if (fd < 0)
+        {
+            if (mLeader < 0 && mError.empty())
+                mError = strerror(errno);
+            continue;
+        }
+        if (mLeader < 0)
+            mLeader = fd;
+        mFds.push_back(fd);
+        mEvents.push_back(i);
+    }
+    if (mLeader >= 0)
+    {
+        mError.clear();
+        read(mLast, mLastEnabled, mLastRunning);
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    // members go before the leader
+    for (size_t i = mFds.size(); i-- > 0;)
+        close(mFds[i]);
+}
+
+bool PerfCounters::read(uint64_t *values, uint64_t &enabled, uint64_t &running)
+{
+    // { nr, time_enabled, time_running, values[nr] }
+    uint64_t buffer[3 + MAX_EVENTS];
+    ssize_t bytes = ::read(mLeader, buffer, sizeof(uint64_t) * (3 + mFds.size()));
+    if (bytes < (ssize_t)(sizeof(uint64_t) * (3 + mFds.size())) || buffer[0] != mFds.size())
+        return false;
+    enabled = buffer[1];
+    running = buffer[2];
+    std::copy(buffer + 3, buffer + 3 + mFds.size(), values);
+    return true;
+}
+
+void PerfCounters::charge()
+{
+    Clock::time_point now = Clock::now();
+    uint64_t values[MAX_EVENTS];
+    uint64_t enabled = 0, running = 0;
+    bool counted = mLeader >= 0 && read(values, enabled, running);
+    if (!mStack.empty())
+    {
+        Totals &totals = mTotals[mStack.back()];
+        totals.wall += now - mLastTime;
+        if (counted)
+        {
+            uint64_t enabledDelta = enabled - mLastEnabled;
+            uint64_t runningDelta = running - mLastRunning;
+            totals.enabled += enabledDelta;
+            totals.running += runningDelta;
+            // nothing was counted if the group never got on the PMU
+            if (runningDelta != 0)
+            {
+                double scale = (double)enabledDelta / runningDelta;
+                for (size_t i = 0; i < mFds.size(); ++i)
+                    totals.events[i] += (uint64_t)((values[i] - mLast[i]) * scale + 0.5);
+            }
+        }
+    }
+    mLastTime = now;
+    if (counted)
+    {
+        std::copy(values, values + mFds.size(), mLast);
+        mLastEnabled = enabled;
+        mLastRunning = running;
+    }
+}
+
+void PerfCounters::enterFunction(FunctionDecl *fdecl)
+{
+    charge();
+    mStack.push_back(fdecl);
+    ++mTotals[fdecl].calls;
+}
+
+void PerfCounters::leaveFunction()
+{
+    charge();
+    mStack.pop_back();
+}
+
+void PerfCounters::switchFunction(FunctionDecl *fdecl)
+{
+    charge();
+    mStack.back() = fdecl;
+    ++mTotals[fdecl].calls;
+}
+
+void PerfCounters::report(llvm::raw_ostream &os)
+{
+    if (mFds.empty())
+        os << "hardware counters unavailable (" << mError << "), wall clock time only\n";
+    uint64_t enabled = 0, running = 0;
+    for (const auto &function : mTotals)
+    {
+        enabled += function.second.enabled;
+        running += function.second.running;
+    }
+    if (running < enabled)
+        os << "counters multiplexed, on the PMU " << llvm::format("%.1f", running * 100.0 / enabled)
+           << "% of the time, counts are scaled estimates\n";
+
+    int cycles = -1, instructions = -1;
+    os << "function                 calls         wall ms";
+    for (size_t i = 0; i < mEvents.size(); ++i)
+    {
+        os << llvm::right_justify(EVENTS[mEvents[i]].name, 16);
+        if (mEvents[i] == CYCLES)
+            cycles = i;
+        else if (mEvents[i] == INSTRUCTIONS)
+            instructions = i;
+    }
+    bool ipc = cycles >= 0 && instructions >= 0;
+    if (ipc)
+        os << "     IPC";
+    os << "\n";
+
+    std::vector<std::pair<FunctionDecl *, const Totals *>> functions;
+    for (const auto &function : mTotals)
+        functions.push_back(std::make_pair(function.first, &function.second));
+    std::stable_sort(functions.begin(), functions.end(),
+                     [](const std::pair<FunctionDecl *, const Totals *> &a, const std::pair<FunctionDecl *, const Totals *> &b) {
+                         return a.second->wall > b.second->wall;
+                     });
+    for (const auto &function : functions)
+    {
+        const Totals &totals = *function.second;
+        os << llvm::left_justify(function.first->getNameAsString(), 16) << llvm::format_decimal(totals.calls, 14)
+           << llvm::format("%16.3f", std::chrono::duration<double, std::milli>(totals.wall).count());
+        // enabled but never scheduled, a zero would read as a measurement
+        bool uncounted = totals.enabled != 0 && totals.running == 0;
+        for (size_t i = 0; i < mEvents.size(); ++i)
+        {
+            if (uncounted)
+                os << llvm::right_justify("not counted", 16);
+            else
+                os << llvm::format_decimal(totals.events[i], 16);
+        }
+        if (ipc && !uncounted)
+            os << llvm::format("%8.2f", totals.events[cycles] ? (double)totals.events[instructions] / totals.events[cycles] : 0.0);
+        os << "\n";
+    }
+}
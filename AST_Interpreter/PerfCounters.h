@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+/// Host hardware counters (cycles, instructions, L1D and LLC misses, branch
+/// misses) charged to the guest function the AST walker is running. The
+/// counters are read as one perf_event_open group on every call, return and
+/// tail call and the delta since the previous read goes to the function on
+/// top of the stack, so each function's figures exclude its callees.
+/// Counters the kernel refuses (containers, perf_event_paranoid) are left
+/// out; with none at all only wall clock time is reported. When the PMU is
+/// shared the kernel multiplexes the group, a delta is then scaled by the
+/// share of the interval the group was actually counting.
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    void enterFunction(FunctionDecl *fdecl);
+    void leaveFunction();
+    /// a tail call, fdecl runs in the frame of the function on top
+    void switchFunction(FunctionDecl *fdecl);
+
+    /// per function table, heaviest first
+    void report(llvm::raw_ostream &os);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const unsigned MAX_EVENTS = 5;
+
+    struct Totals
+    {
+        uint64_t calls = 0;
+        Clock::duration wall = Clock::duration::zero();
+        uint64_t events[MAX_EVENTS] = {};
+        /// ns the group was enabled and counting while the function ran
+        uint64_t enabled = 0;
+        uint64_t running = 0;
+    };
+
+    /// group members in read order, mLeader is the first one's descriptor
+    std::vector<int> mFds;
+    /// index into the event table of every group member
+    std::vector<unsigned> mEvents;
+    int mLeader;
+    /// why the first counter could not be opened, empty if it could
+    std::string mError;
+
+    std::vector<FunctionDecl *> mStack;
+    std::map<FunctionDecl *, Totals> mTotals;
+    uint64_t mLast[MAX_EVENTS];
+    uint64_t mLastEnabled;
+    uint64_t mLastRunning;
+    Clock::time_point mLastTime;
+
+    /// charge everything counted since the last read to the function on top
+    void charge();
+    bool read(uint64_t *values, uint64_t &enabled, uint64_t &running);
+};
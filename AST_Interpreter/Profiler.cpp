@@ -0,0 +1,168 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+
+Profiler::Profiler(const SourceManager &sources) : mSources(sources), mContext(&mRoot)
+{
+}
+
+void Profiler::enter(Record &record)
+{
+    ++record.count;
+    ++record.active;
+    mOpen.push_back(Open{&record, Clock::now(), Clock::duration::zero(), Clock::duration::zero()});
+}
+
+Profiler::Clock::duration Profiler::leave(Open &open)
+{
+    Clock::duration elapsed = Clock::now() - open.start;
+    if (--open.record->active == 0)
+        open.record->inclusive += elapsed;
+    if (!mOpen.empty())
+        mOpen.back().nested += elapsed;
+    return elapsed;
+}
+
+void Profiler::enterStmt(Stmt *stmt)
+{
+    enter(mStmts[stmt]);
+}
+
+void Profiler::leaveStmt()
+{
+    Open open = mOpen.back();
+    mOpen.pop_back();
+    Clock::duration elapsed = leave(open);
+    open.record->exclusive += elapsed - open.nested;
+}
+
+void Profiler::enterFunction(FunctionDecl *fdecl, bool newFrame)
+{
+    Record &record = mFunctions[fdecl];
+    if (newFrame)
+        ++record.frames;
+    enter(record);
+    mOpenFunctions.push_back(mOpen.size() - 1);
+
+    std::unique_ptr<Context> &callee = mContext->callees[fdecl];
+    if (!callee)
+    {
+        callee.reset(new Context());
+        callee->parent = mContext;
+    }
+    mContext = callee.get();
+}
+
+void Profiler::leaveFunction()
+{
+    assert(mOpenFunctions.back() == mOpen.size() - 1);
+    mOpenFunctions.pop_back();
+    Open open = mOpen.back();
+    mOpen.pop_back();
+    Clock::duration elapsed = leave(open);
+    open.record->exclusive += elapsed - open.callees;
+    if (!mOpenFunctions.empty())
+        mOpen[mOpenFunctions.back()].callees += elapsed;
+
+    mContext->self += elapsed - open.callees;
+    mContext = mContext->parent;
+}
+
+llvm::StringRef Profiler::sourceLine(const SourceManager &sources, Stmt *stmt, PresumedLoc &presumed)
+{
+    SourceLocation loc = sources.getExpansionLoc(stmt->getBeginLoc());
+    presumed = sources.getPresumedLoc(loc);
+    if (presumed.isInvalid())
+        return llvm::StringRef();
+    const char *begin = sources.getCharacterData(loc) - (presumed.getColumn() - 1);
+    const char *end = begin;
+    while (*end != '\0' && *end != '\n' && *end != '\r')
+        ++end;
+    return llvm::StringRef(begin, end - begin);
+}
+
+static double milliseconds(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+bool Profiler::write(const std::string &prefix) const
+{
+    std::error_code error;
+    llvm::raw_fd_ostream annotated(prefix + ".annotated", error, llvm::sys::fs::OF_Text);
+    if (error)
+        return false;
+    writeAnnotated(annotated);
+
+    llvm::raw_fd_ostream folded(prefix + ".folded", error, llvm::sys::fs::OF_Text);
+    if (error)
+        return false;
+    writeFolded(folded, mRoot, std::string());
+    return true;
+}
+
+void Profiler::writeAnnotated(llvm::raw_ostream &os) const
+{
+    std::vector<std::pair<FunctionDecl *, const Record *>> functions;
+    for (const auto &function : mFunctions)
+        functions.push_back(std::make_pair(function.first, &function.second));
+    std::stable_sort(functions.begin(), functions.end(),
+                     [](const std::pair<FunctionDecl *, const Record *> &a, const std::pair<FunctionDecl *, const Record *> &b) {
+                         return a.second->inclusive > b.second->inclusive;
+                     });
+    os << "function                 calls          frames    inclusive ms    exclusive ms\n";
+    for (const auto &function : functions)
+    {
+        const Record &record = *function.second;
+        os << llvm::left_justify(function.first->getNameAsString(), 16) << llvm::format_decimal(record.count, 14)
+           << llvm::format_decimal(record.frames, 16) << llvm::format("%16.3f", milliseconds(record.inclusive))
+           << llvm::format("%16.3f", milliseconds(record.exclusive)) << "\n";
+    }
+
+    // statements in source order, several on one line are told apart by column
+    struct Row
+    {
+        std::string file;
+        unsigned line;
+        unsigned column;
+        llvm::StringRef text;
+        const Record *record;
+    };
+    std::vector<Row> rows;
+    for (const auto &stmt : mStmts)
+    {
+        PresumedLoc presumed;
+        llvm::StringRef text = sourceLine(mSources, stmt.first, presumed);
+        if (presumed.isInvalid())
+            continue;
+        rows.push_back(Row{presumed.getFilename(), presumed.getLine(), presumed.getColumn(), text, &stmt.second});
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+        return std::tie(a.file, a.line, a.column) < std::tie(b.file, b.line, b.column);
+    });
+    os << "\nlocation                 count    inclusive ms    exclusive ms  source\n";
+    for (const Row &row : rows)
+    {
+        std::string location = row.file + ":" + std::to_string(row.line) + ":" + std::to_string(row.column);
+        os << llvm::left_justify(location, 16) << llvm::format_decimal(row.record->count, 14)
+           << llvm::format("%16.3f", milliseconds(row.record->inclusive))
+           << llvm::format("%16.3f", milliseconds(row.record->exclusive)) << "  | " << row.text << "\n";
+    }
+}
+
+void Profiler::writeFolded(llvm::raw_ostream &os, const Context &context, const std::string &stack) const
+{
+    for (const auto &callee : context.callees)
+    {
+        std::string name = callee.first->getNameAsString();
+        std::string calleeStack = stack.empty() ? name : stack + ";" + name;
+        int64_t self = std::chrono::duration_cast<std::chrono::microseconds>(callee.second->self).count();
+        if (self > 0)
+            os << calleeStack << " " << self << "\n";
+        writeFolded(os, *callee.second, calleeStack);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+/// Execution counts and times of the statements and functions the AST walker
+/// runs. Every statement of a block and every function body is bracketed by
+/// enter / leave calls; the walker makes none of them unless profiling, so
+/// an idle profiler costs one null test per statement.
+///  - inclusive time counts the outermost activation only, a recursive
+///    function is not charged twice for the same time
+///  - a statement's exclusive time leaves out the statements nested in it
+///    and the calls it makes, a function's leaves out its callees only
+class Profiler
+{
+public:
+    explicit Profiler(const SourceManager &sources);
+
+    void enterStmt(Stmt *stmt);
+    void leaveStmt();
+    /// fdecl's body starts running, in a frame of its own unless newFrame is
+    /// false (a tail call reusing its caller's frame)
+    void enterFunction(FunctionDecl *fdecl, bool newFrame);
+    void leaveFunction();
+
+    /// Writes prefix.annotated (functions, then every statement that ran
+    /// with its file:line:column and source line) and prefix.folded
+    /// (collapsed call stacks weighted by exclusive microseconds, the input
+    /// of flamegraph.pl). False if either file cannot be written.
+    bool write(const std::string &prefix) const;
+
+    /// The source line stmt begins on, presumed is its file, line and column
+    static llvm::StringRef sourceLine(const SourceManager &sources, Stmt *stmt, PresumedLoc &presumed);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Record
+    {
+        uint64_t count = 0;
+        uint64_t frames = 0;
+        Clock::duration inclusive = Clock::duration::zero();
+        Clock::duration exclusive = Clock::duration::zero();
+        /// activations currently on the walker's stack
+        unsigned active = 0;
+    };
+    /// an activation of a statement or function that has not left yet
+    struct Open
+    {
+        Record *record;
+        Clock::time_point start;
+        /// time of the activations directly nested in this one
+        Clock::duration nested;
+        /// time of the functions called from this one, functions only
+        Clock::duration callees;
+    };
+    /// node of the calling context tree the collapsed stacks come from
+    struct Context
+    {
+        Context *parent = nullptr;
+        Clock::duration self = Clock::duration::zero();
+        std::map<FunctionDecl *, std::unique_ptr<Context>> callees;
+    };
+
+    const SourceManager &mSources;
+    std::unordered_map<Stmt *, Record> mStmts;
+    std::map<FunctionDecl *, Record> mFunctions;
+    std::vector<Open> mOpen;
+    /// positions in mOpen of the open functions
+    std::vector<size_t> mOpenFunctions;
+    Context mRoot;
+    Context *mContext;
+
+    void enter(Record &record);
+    /// closes the innermost activation, returns its elapsed time
+    Clock::duration leave(Open &open);
+    void writeAnnotated(llvm::raw_ostream &os) const;
+    void writeFolded(llvm::raw_ostream &os, const Context &context, const std::string &stack) const;
+};
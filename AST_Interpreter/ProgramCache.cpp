@@ -0,0 +1,380 @@
+#include "ProgramCache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+// Entry layout, all fields native endian:
+//   Header, globals (padded to 8), then per function a FunctionHeader,
+//   its name (padded to 8), its code as raw Instr records and its
+//   VectorLoop records (padded to 8).
+namespace
+{
+const char MAGIC[8] = {'C', 'P', 'P', 'E', 'B', 'C', 0, 0};
+
+struct Header
+{
+    char magic[8];
+    /// buildId() of the interpreter that wrote the entry
+    uint64_t build;
+    uint32_t numFunctions;
+    int32_t entry;
+    uint64_t globalsSize;
+};
+
+struct FunctionHeader
+{
+    uint32_t nameSize;
+    uint32_t numParams;
+    uint32_t numRegs;
+    uint32_t frameBytes;
+    uint32_t flags;
+    uint32_t numLoops;
+    uint64_t codeSize;
+};
+
+const uint32_t FN_MEMOIZABLE = 1;
+
+size_t padded(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+/// Identifies the interpreter binary. Any rebuild may change the encoding,
+/// the opcodes or what the lowering emits, so entries only ever match the
+/// build that wrote them; nothing has to be bumped by hand.
+uint64_t buildId()
+{
+    static const uint64_t id = [] {
+        struct stat st;
+        if (stat("/proc/self/exe", &st) != 0)
+            return (uint64_t)0;
+        uint64_t fields[] = {(uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+                             (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec};
+        return llvm::xxHash64(llvm::StringRef((const char *)fields, sizeof(fields)));
+    }();
+    return id;
+}
+
+bool validRegister(const CompiledFunction &fn, int32_t reg)
+{
+    return reg >= 0 && (uint32_t)reg < fn.numRegs;
+}
+
+bool validTarget(const CompiledFunction &fn, int32_t pc)
+{
+    return pc >= 0 && (size_t)pc < fn.code.size();
+}
+
+bool validGlobal(const Program &program, int32_t offset, size_t width)
+{
+    return offset >= 0 && (size_t)offset + width <= program.globals.size();
+}
+
+bool validOperand(const CompiledFunction &fn, const VectorOperand &operand)
+{
+    switch (operand.kind)
+    {
+    case VectorOperand::ARRAY:
+    case VectorOperand::REG:
+        return validRegister(fn, operand.value);
+    case VectorOperand::IMM:
+        return true;
+    }
+    return false;
+}
+
+bool validLoop(const CompiledFunction &fn, const VectorLoop &loop)
+{
+    if (loop.op > VectorLoop::MUL || loop.limit.kind == VectorOperand::ARRAY)
+        return false;
+    // dst is a register index for both kinds, but a SUM must read an array
+    if (loop.kind == VectorLoop::SUM && loop.lhs.kind != VectorOperand::ARRAY)
+        return false;
+    if (loop.kind != VectorLoop::MAP && loop.kind != VectorLoop::SUM)
+        return false;
+    return validRegister(fn, loop.counter) && validRegister(fn, loop.dst) && validOperand(fn, loop.limit) &&
+           validOperand(fn, loop.lhs) && validOperand(fn, loop.rhs);
+}
+
+/// The VM and the JIT trust every operand, so an entry that is corrupt (or
+/// crafted) must not get past load: each instruction may only name registers
+/// of its frame, pcs of its code, functions, loops and globals that exist.
+bool validInstr(const Program &program, const CompiledFunction &fn, const Instr &in)
+{
+    switch (in.op)
+    {
+    case OP_NOP:
+    case OP_RETV:
+        return true;
+    case OP_LOADI:
+    case OP_GET:
+    case OP_PRINT:
+    case OP_FREE:
+    case OP_RET:
+        return validRegister(fn, in.a);
+    case OP_MOV:
+    case OP_NEG_I:
+    case OP_NOT_B:
+    case OP_NEZ_I:
+    case OP_NEZ_P:
+    case OP_I2U:
+    case OP_U2I:
+    case OP_I2C:
+    case OP_LOAD8:
+    case OP_LOAD32:
+    case OP_LOAD64:
+    case OP_STORE8:
+    case OP_STORE32:
+    case OP_STORE64:
+    case OP_MALLOC:
+    case OP_ADDK_I:
+        return validRegister(fn, in.a) && validRegister(fn, in.b);
+    case OP_ADD_I:
+    case OP_SUB_I:
+    case OP_MUL_I:
+    case OP_DIV_I:
+    case OP_REM_I:
+    case OP_ADD_U:
+    case OP_SUB_U:
+    case OP_MUL_U:
+    case OP_DIV_U:
+    case OP_EQ_I:
+    case OP_NE_I:
+    case OP_LT_I:
+    case OP_GT_I:
+    case OP_LE_I:
+    case OP_GE_I:
+    case OP_EQ_U:
+    case OP_NE_U:
+    case OP_LT_U:
+    case OP_GT_U:
+    case OP_LE_U:
+    case OP_GE_U:
+    case OP_PADD:
+    case OP_PSUB:
+    case OP_LOADX8:
+    case OP_LOADX32:
+    case OP_LOADX64:
+    case OP_STOREX8:
+    case OP_STOREX32:
+    case OP_STOREX64:
+        return validRegister(fn, in.a) && validRegister(fn, in.b) && validRegister(fn, in.c);
+    case OP_LOADG8:
+    case OP_STOREG8:
+        return validRegister(fn, in.a) && validGlobal(program, in.b, 1);
+    case OP_LOADG32:
+    case OP_STOREG32:
+        return validRegister(fn, in.a) && validGlobal(program, in.b, 4);
+    case OP_LOADG64:
+    case OP_STOREG64:
+        return validRegister(fn, in.a) && validGlobal(program, in.b, 8);
+    case OP_ADDRG:
+        return validRegister(fn, in.a) && validGlobal(program, in.b, 0);
+    case OP_ADDRL:
+        return validRegister(fn, in.a) && in.b >= 0 && (uint32_t)in.b <= fn.frameBytes;
+    case OP_JMP:
+        return validTarget(fn, in.a);
+    case OP_JT:
+    case OP_JF:
+        return validRegister(fn, in.a) && validTarget(fn, in.b);
+    case OP_CALL:
+    case OP_TAILCALL:
+    {
+        if (in.b < 0 || (size_t)in.b >= program.functions.size() || (in.a != -1 && !validRegister(fn, in.a)))
+            return false;
+        // the arguments are the callee's numParams registers from c on
+        uint32_t numArgs = program.functions[in.b].numParams;
+        return numArgs == 0 || (in.c >= 0 && (uint64_t)in.c + numArgs <= fn.numRegs);
+    }
+    case OP_VLOOP:
+        return in.a >= 0 && (size_t)in.a < fn.loops.size() && validTarget(fn, in.b);
+    case OP_JEQ_I:
+    case OP_JNE_I:
+    case OP_JLT_I:
+    case OP_JGT_I:
+    case OP_JLE_I:
+    case OP_JGE_I:
+        return validRegister(fn, in.a) && validRegister(fn, in.b) && validTarget(fn, in.c);
+    case OP_JEQK_I:
+    case OP_JNEK_I:
+    case OP_JLTK_I:
+    case OP_JGTK_I:
+    case OP_JLEK_I:
+    case OP_JGEK_I:
+        return validRegister(fn, in.a) && validTarget(fn, in.c);
+    case OP_COUNT:
+        break;
+    }
+    return false;
+}
+
+bool validProgram(const Program &program)
+{
+    if (program.entry < 0 || (size_t)program.entry >= program.functions.size() ||
+        program.functions[program.entry].numParams != 0)
+        return false;
+    for (const CompiledFunction &fn : program.functions)
+    {
+        // execution must never run past the last instruction
+        if (fn.numParams > fn.numRegs || fn.code.empty() ||
+            (fn.code.back().op != OP_RET && fn.code.back().op != OP_RETV && fn.code.back().op != OP_JMP))
+            return false;
+        for (const VectorLoop &loop : fn.loops)
+            if (!validLoop(fn, loop))
+                return false;
+        for (const Instr &in : fn.code)
+            if (!validInstr(program, fn, in))
+                return false;
+    }
+    return true;
+}
+
+/// bounds checked reader over the mapped entry
+class Reader
+{
+    const char *mPos;
+    const char *mEnd;
+
+public:
+    Reader(const char *begin, size_t size) : mPos(begin), mEnd(begin + size) {}
+    const char *take(size_t bytes)
+    {
+        if ((size_t)(mEnd - mPos) < bytes)
+            return nullptr;
+        const char *result = mPos;
+        mPos += padded(bytes) <= (size_t)(mEnd - mPos) ? padded(bytes) : bytes;
+        return result;
+    }
+};
+} // namespace
+
+std::string ProgramCache::entryFor(llvm::StringRef source, llvm::StringRef options) const
+{
+    // the build is part of the key, a rebuilt interpreter never hits stale entries
+    std::string key = options.str();
+    key += '\0';
+    key += std::to_string(buildId());
+    uint64_t hash = llvm::xxHash64(source) ^ (llvm::xxHash64(key) * 0x9E3779B97F4A7C15ull);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cppebc", (unsigned long long)hash);
+    llvm::SmallString<128> path(mDirectory);
+    llvm::sys::path::append(path, name);
+    return path.str().str();
+}
+
+bool ProgramCache::load(const std::string &entry, Program &program)
+{
+    int fd = open(entry.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return false;
+
+    Program loaded;
+    bool ok = false;
+    Reader reader((const char *)mapped, size);
+    const Header *header = (const Header *)reader.take(sizeof(Header));
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 && header->build == buildId())
+    {
+        const char *globals = reader.take(header->globalsSize);
+        ok = globals != nullptr;
+        if (ok)
+            loaded.globals.assign(globals, globals + header->globalsSize);
+        for (uint32_t i = 0; ok && i < header->numFunctions; ++i)
+        {
+            const FunctionHeader *fnHeader = (const FunctionHeader *)reader.take(sizeof(FunctionHeader));
+            const char *name = fnHeader ? reader.take(fnHeader->nameSize) : nullptr;
+            const char *code = name && fnHeader->codeSize < size ? reader.take(fnHeader->codeSize * sizeof(Instr)) : nullptr;
+            const char *loops = code && fnHeader->numLoops < size ? reader.take(fnHeader->numLoops * sizeof(VectorLoop)) : nullptr;
+            if (!loops)
+            {
+                ok = false;
+                break;
+            }
+            CompiledFunction fn;
+            fn.name.assign(name, fnHeader->nameSize);
+            fn.numParams = fnHeader->numParams;
+            fn.numRegs = fnHeader->numRegs;
+            fn.frameBytes = fnHeader->frameBytes;
+            fn.memoizable = (fnHeader->flags & FN_MEMOIZABLE) != 0;
+            fn.code.assign((const Instr *)code, (const Instr *)code + fnHeader->codeSize);
+            fn.loops.assign((const VectorLoop *)loops, (const VectorLoop *)loops + fnHeader->numLoops);
+            loaded.functions.push_back(std::move(fn));
+        }
+        loaded.entry = header->entry;
+        ok = ok && validProgram(loaded);
+    }
+    munmap(mapped, size);
+    if (ok)
+        program = std::move(loaded);
+    return ok;
+}
+
+bool ProgramCache::store(const std::string &entry, const Program &program)
+{
+    llvm::sys::fs::create_directories(llvm::sys::path::parent_path(entry));
+    std::string temp = entry + ".tmp" + std::to_string(getpid());
+    {
+        std::error_code error;
+        llvm::raw_fd_ostream out(temp, error, llvm::sys::fs::OF_None);
+        if (error)
+            return false;
+        const char zeros[8] = {};
+
+        Header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.build = buildId();
+        header.numFunctions = program.functions.size();
+        header.entry = program.entry;
+        header.globalsSize = program.globals.size();
+        out.write((const char *)&header, sizeof(header));
+        out.write(program.globals.data(), program.globals.size());
+        out.write(zeros, padded(program.globals.size()) - program.globals.size());
+
+        for (const CompiledFunction &fn : program.functions)
+        {
+            FunctionHeader fnHeader;
+            fnHeader.nameSize = fn.name.size();
+            fnHeader.numParams = fn.numParams;
+            fnHeader.numRegs = fn.numRegs;
+            fnHeader.frameBytes = fn.frameBytes;
+            fnHeader.flags = fn.memoizable ? FN_MEMOIZABLE : 0;
+            fnHeader.numLoops = fn.loops.size();
+            fnHeader.codeSize = fn.code.size();
+            out.write((const char *)&fnHeader, sizeof(fnHeader));
+            out.write(fn.name.data(), fn.name.size());
+            out.write(zeros, padded(fn.name.size()) - fn.name.size());
+            out.write((const char *)fn.code.data(), fn.code.size() * sizeof(Instr));
+            size_t loopBytes = fn.loops.size() * sizeof(VectorLoop);
+            out.write((const char *)fn.loops.data(), loopBytes);
+            out.write(zeros, padded(loopBytes) - loopBytes);
+        }
+        out.close();
+        if (out.has_error())
+        {
+            out.clear_error();
+            remove(temp.c_str());
+            return false;
+        }
+    }
+    return rename(temp.c_str(), entry.c_str()) == 0;
+}
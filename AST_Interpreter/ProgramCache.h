@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "Bytecode.h"
+
+/// On-disk cache of lowered programs.
+/// An entry is the serialized Program of one source text, named after a hash
+/// of the source and of the options that influence lowering. A hit is mapped
+/// into memory and decoded without running the clang frontend at all.
+class ProgramCache
+{
+public:
+    explicit ProgramCache(const std::string &directory) : mDirectory(directory) {}
+
+    /// path of the entry for source lowered under options
+    std::string entryFor(llvm::StringRef source, llvm::StringRef options) const;
+    /// false if the entry is missing, truncated, written by another build of
+    /// the interpreter or names a register, pc, function or global out of range
+    static bool load(const std::string &entry, Program &program);
+    /// written to a temporary file first, so readers never see half an entry
+    static bool store(const std::string &entry, const Program &program);
+
+private:
+    std::string mDirectory;
+};
@@ -0,0 +1,123 @@
+#include "PurityAnalysis.h"
+
+#include "clang/AST/Stmt.h"
+
+#include "MemoTable.h"
+
+PurityAnalysis::PurityAnalysis(TranslationUnitDecl *unit)
+{
+    std::map<const FunctionDecl *, std::vector<const FunctionDecl *>> callees;
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i)
+    {
+        FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+        if (fdecl == NULL || !fdecl->isThisDeclarationADefinition())
+            continue;
+        const FunctionDecl *canonical = fdecl->getCanonicalDecl();
+        if (scan(fdecl->getBody(), callees[canonical]))
+            mPure.insert(canonical);
+    }
+    // a function stays pure only while every function it calls does
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (std::set<const FunctionDecl *>::iterator it = mPure.begin(); it != mPure.end();)
+        {
+            const std::vector<const FunctionDecl *> &calls = callees[*it];
+            bool impureCallee = false;
+            for (const FunctionDecl *callee : calls)
+                impureCallee |= mPure.count(callee) == 0;
+            if (impureCallee)
+            {
+                it = mPure.erase(it);
+                changed = true;
+            }
+            else
+                ++it;
+        }
+    }
+}
+
+bool PurityAnalysis::isPure(const FunctionDecl *fdecl) const
+{
+    return mPure.count(fdecl->getCanonicalDecl()) != 0;
+}
+
+static bool isInt(QualType type)
+{
+    const BuiltinType *builtinType = dyn_cast<BuiltinType>(type.getCanonicalType().getTypePtr());
+    return builtinType != NULL && builtinType->getKind() == BuiltinType::Kind::Int;
+}
+
+bool PurityAnalysis::isMemoizable(const FunctionDecl *fdecl) const
+{
+    if (!isPure(fdecl) || !isInt(fdecl->getReturnType()) || fdecl->getNumParams() > MemoTable::MAX_ARGS)
+        return false;
+    for (unsigned i = 0; i < fdecl->getNumParams(); ++i)
+        if (!isInt(fdecl->getParamDecl(i)->getType()))
+            return false;
+    return true;
+}
+
+bool PurityAnalysis::scan(Stmt *stmt, std::vector<const FunctionDecl *> &callees)
+{
+    if (stmt == NULL)
+        return true;
+    // the operand of sizeof is never evaluated
+    if (isa<UnaryExprOrTypeTraitExpr>(stmt))
+        return true;
+
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt))
+    {
+        if (bop->isAssignmentOp() && !isLocal(bop->getLHS()))
+            return false;
+    }
+    else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt))
+    {
+        if (uop->getOpcode() == UnaryOperator::Opcode::UO_Deref)
+            return false;
+        if (uop->isIncrementDecrementOp() && !isLocal(uop->getSubExpr()))
+            return false;
+    }
+    else if (ArraySubscriptExpr *subscript = dyn_cast<ArraySubscriptExpr>(stmt))
+    {
+        if (!isLocal(subscript))
+            return false;
+    }
+    else if (DeclRefExpr *declRef = dyn_cast<DeclRefExpr>(stmt))
+    {
+        VarDecl *varDecl = dyn_cast<VarDecl>(declRef->getDecl());
+        if (varDecl != NULL && !varDecl->hasLocalStorage() && !varDecl->getType().isConstQualified())
+            return false;
+    }
+    else if (CallExpr *call = dyn_cast<CallExpr>(stmt))
+    {
+        // builtins are declared without a body
+        FunctionDecl *callee = call->getDirectCallee();
+        if (callee == NULL || !callee->hasBody())
+            return false;
+        callees.push_back(callee->getCanonicalDecl());
+    }
+
+    for (Stmt *child : stmt->children())
+        if (!scan(child, callees))
+            return false;
+    return true;
+}
+
+bool PurityAnalysis::isLocal(Expr *expr)
+{
+    expr = expr->IgnoreParenImpCasts();
+    if (ArraySubscriptExpr *subscript = dyn_cast<ArraySubscriptExpr>(expr))
+    {
+        // only arrays declared in the frame, not whatever a pointer points at
+        Expr *base = subscript->getBase()->IgnoreParenImpCasts();
+        return base->getType()->isArrayType() && isLocal(base);
+    }
+    if (DeclRefExpr *declRef = dyn_cast<DeclRefExpr>(expr))
+    {
+        VarDecl *varDecl = dyn_cast<VarDecl>(declRef->getDecl());
+        return varDecl != NULL && varDecl->hasLocalStorage();
+    }
+    return false;
+}
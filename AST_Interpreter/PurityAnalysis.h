@@ -0,0 +1,35 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+
+using namespace clang;
+
+/// Finds the guest functions whose result depends on nothing but their
+/// arguments: they never touch a global that is not const, never read or
+/// write memory other than their own locals and local arrays, never call a
+/// builtin (GET, PRINT, MALLOC, FREE) and only call pure functions.
+/// Calls to such a function may be answered from a MemoTable.
+class PurityAnalysis
+{
+public:
+    explicit PurityAnalysis(TranslationUnitDecl *unit);
+
+    bool isPure(const FunctionDecl *fdecl) const;
+    /// pure, returns int and takes at most MemoTable::MAX_ARGS int parameters
+    bool isMemoizable(const FunctionDecl *fdecl) const;
+
+private:
+    /// canonical declarations
+    std::set<const FunctionDecl *> mPure;
+
+    /// false if stmt has an effect by itself, callees collects the guest
+    /// functions it calls
+    bool scan(Stmt *stmt, std::vector<const FunctionDecl *> &callees);
+    /// a local variable or an element of a local array
+    static bool isLocal(Expr *expr);
+};
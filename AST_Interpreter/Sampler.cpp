@@ -0,0 +1,160 @@
+#include "Sampler.h"
+
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <tuple>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+
+#include "Profiler.h"
+
+volatile sig_atomic_t Sampler::sTicks = 0;
+
+void Sampler::handler(int)
+{
+    sTicks = sTicks + 1;
+}
+
+Sampler::Sampler(const SourceManager &sources, unsigned intervalMicros)
+    : mSources(sources), mInterval(std::max(intervalMicros, 1u)), mTimer(), mRunning(false), mSamples(0)
+{
+}
+
+Sampler::~Sampler()
+{
+    stop();
+}
+
+bool Sampler::start()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    // GET may be blocked in read() when the timer fires
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &action, &mPrevious) != 0)
+        return false;
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &mTimer) != 0)
+    {
+        sigaction(SIGPROF, &mPrevious, nullptr);
+        return false;
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = mInterval / 1000000;
+    spec.it_interval.tv_nsec = (long)(mInterval % 1000000) * 1000;
+    spec.it_value = spec.it_interval;
+    if (timer_settime(mTimer, 0, &spec, nullptr) != 0)
+    {
+        timer_delete(mTimer);
+        sigaction(SIGPROF, &mPrevious, nullptr);
+        return false;
+    }
+    mRunning = true;
+    return true;
+}
+
+void Sampler::stop()
+{
+    if (!mRunning)
+        return;
+    timer_delete(mTimer);
+    sigaction(SIGPROF, &mPrevious, nullptr);
+    sTicks = 0;
+    mRunning = false;
+}
+
+void Sampler::sample(std::deque<StackFrame> &stack)
+{
+    // a statement that ran over several ticks stands for all of them
+    uint64_t ticks = sTicks;
+    sTicks = 0;
+    if (stack.empty())
+        return;
+    mSamples += ticks;
+    std::vector<FunctionDecl *> functions;
+    functions.reserve(stack.size());
+    for (StackFrame &frame : stack)
+        functions.push_back(frame.getLayout()->getFunction());
+    mStacks[functions] += ticks;
+    // a frame that has not evaluated anything yet counts for its function only
+    if (Stmt *pc = stack.back().getPC())
+        mPCs[pc] += ticks;
+}
+
+bool Sampler::write(const std::string &prefix) const
+{
+    std::error_code error;
+    llvm::raw_fd_ostream report(prefix + ".samples", error, llvm::sys::fs::OF_Text);
+    if (error)
+        return false;
+    writeReport(report);
+
+    llvm::raw_fd_ostream folded(prefix + ".samples.folded", error, llvm::sys::fs::OF_Text);
+    if (error)
+        return false;
+    for (const auto &stack : mStacks)
+    {
+        for (size_t i = 0; i < stack.first.size(); ++i)
+            folded << (i ? ";" : "") << stack.first[i]->getNameAsString();
+        folded << " " << stack.second << "\n";
+    }
+    return true;
+}
+
+void Sampler::writeReport(llvm::raw_ostream &os) const
+{
+    double percent = mSamples ? 100.0 / mSamples : 0.0;
+    os << mSamples << " samples, one every " << mInterval << " us of CPU time\n\n";
+
+    // self : innermost frame, total : anywhere on the stack, once per sample
+    std::map<FunctionDecl *, std::pair<uint64_t, uint64_t>> functions;
+    for (const auto &stack : mStacks)
+    {
+        functions[stack.first.back()].first += stack.second;
+        std::set<FunctionDecl *> seen(stack.first.begin(), stack.first.end());
+        for (FunctionDecl *fdecl : seen)
+            functions[fdecl].second += stack.second;
+    }
+    std::vector<std::pair<FunctionDecl *, std::pair<uint64_t, uint64_t>>> byself(functions.begin(), functions.end());
+    std::stable_sort(byself.begin(), byself.end(),
+                     [](const std::pair<FunctionDecl *, std::pair<uint64_t, uint64_t>> &a,
+                        const std::pair<FunctionDecl *, std::pair<uint64_t, uint64_t>> &b) {
+                         return a.second.first > b.second.first;
+                     });
+    os << "function                  self           total\n";
+    for (const auto &function : byself)
+    {
+        os << llvm::left_justify(function.first->getNameAsString(), 16)
+           << llvm::format_decimal(function.second.first, 10) << llvm::format(" %5.1f%%", function.second.first * percent)
+           << llvm::format_decimal(function.second.second, 10) << llvm::format(" %5.1f%%", function.second.second * percent)
+           << "\n";
+    }
+
+    // program counters of one line add up
+    std::map<std::tuple<std::string, unsigned>, std::pair<uint64_t, llvm::StringRef>> lines;
+    for (const auto &pc : mPCs)
+    {
+        PresumedLoc presumed;
+        llvm::StringRef text = Profiler::sourceLine(mSources, pc.first, presumed);
+        if (presumed.isInvalid())
+            continue;
+        std::pair<uint64_t, llvm::StringRef> &line = lines[std::make_tuple(std::string(presumed.getFilename()), presumed.getLine())];
+        line.first += pc.second;
+        line.second = text;
+    }
+    os << "\nlocation               samples  source\n";
+    for (const auto &line : lines)
+    {
+        std::string location = std::get<0>(line.first) + ":" + std::to_string(std::get<1>(line.first));
+        os << llvm::left_justify(location, 16) << llvm::format_decimal(line.second.first, 10)
+           << llvm::format(" %5.1f%%", line.second.first * percent) << "  | " << line.second.second << "\n";
+    }
+}
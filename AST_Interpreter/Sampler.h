@@ -0,0 +1,67 @@
+#pragma once
+
+#include <signal.h>
+#include <time.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+#include "StackFrame.h"
+
+/// Statistical profile of the AST walker. A timer on the process's CPU time
+/// raises SIGPROF every interval; the handler only counts the tick, as the
+/// walker's stack may be half updated when it fires. The walker tests the
+/// count between the statements of a block and on every loop iteration and,
+/// when set, records the guest call stack (the function of every frame) and
+/// the program counter of the innermost frame, weighted by the ticks since
+/// the last sample. Between samples that costs one load per statement.
+class Sampler
+{
+public:
+    Sampler(const SourceManager &sources, unsigned intervalMicros);
+    ~Sampler();
+
+    /// arm the timer, false if it cannot be set up
+    bool start();
+    void stop();
+
+    static bool pending()
+    {
+        return sTicks != 0;
+    }
+    void sample(std::deque<StackFrame> &stack);
+
+    /// Writes prefix.samples (samples per function, self and total, and per
+    /// source line) and prefix.samples.folded (collapsed call stacks counted
+    /// in samples, the input of flamegraph.pl), apart from the profiler's
+    /// prefix.folded so both can share a prefix. False if either file cannot be
+    /// written.
+    bool write(const std::string &prefix) const;
+
+private:
+    /// timer ticks not sampled yet
+    static volatile sig_atomic_t sTicks;
+    static void handler(int);
+
+    const SourceManager &mSources;
+    unsigned mInterval;
+    timer_t mTimer;
+    bool mRunning;
+    struct sigaction mPrevious;
+
+    uint64_t mSamples;
+    /// outermost function first
+    std::map<std::vector<FunctionDecl *>, uint64_t> mStacks;
+    /// samples by the innermost frame's program counter
+    std::unordered_map<Stmt *, uint64_t> mPCs;
+
+    void writeReport(llvm::raw_ostream &os) const;
+};
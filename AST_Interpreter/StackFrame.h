@@ -1,56 +1,82 @@
 #pragma once
 
+#include <memory>
+
 #include "clang/AST/Decl.h"
-#include "Object.h"
+#include "FrameArena.h"
+#include "FunctionLayout.h"
+#include "Value.h"
 
 using namespace clang;
 
 class StackFrame
 {
-	/// StackFrame maps Variable Declaration to Value
-	/// Which are either integer or addresses (also represented using an Integer value)
-	std::map<Decl *, Object *> mVars;
-	std::map<Stmt *, Object *> mExprs;
+	/// StackFrame maps Variable Declaration and Expr to Value through the
+	/// function's FunctionLayout, all slots are one contiguous block carved
+	/// from the frame arena
+	const FunctionLayout *mLayout;
+	FrameArena::Mark mArenaMark;
+	Value *mSlots;
 	/// The current stmt
 	Stmt *mPC;
 
-	bool _hasReturn = false;;
-	Object *_returnVal = nullptr;
+	Value _returnVal;
 
 public:
-	StackFrame() : mVars(), mExprs(), mPC()
+	StackFrame(const FunctionLayout *layout, FrameArena &arena) : mLayout(layout), mArenaMark(arena.mark()), mPC()
+	{
+		mSlots = (Value *)arena.allocate(layout->numSlots() * sizeof(Value));
+		std::uninitialized_fill_n(mSlots, layout->numSlots(), Value());
+	}
+	/// A tail call reuses the frame: its slots go back to the arena and are
+	/// carved again, at the same place, for the callee's layout
+	void reset(const FunctionLayout *layout, FrameArena &arena)
+	{
+		arena.release(mArenaMark);
+		mLayout = layout;
+		mSlots = (Value *)arena.allocate(layout->numSlots() * sizeof(Value));
+		std::uninitialized_fill_n(mSlots, layout->numSlots(), Value());
+		mPC = NULL;
+	}
+	/// Everything allocated from the arena after this mark belongs to the frame
+	const FrameArena::Mark &getArenaMark()
 	{
+		return mArenaMark;
 	}
-	void bindDecl(Decl *decl, Object *val)
+	void bindDecl(Decl *decl, const Value &val)
 	{
-		mVars[decl] = val;
+		mSlots[mLayout->declSlot(decl)] = val;
 	}
-	Object *getDeclVal(Decl *decl)
+	/// The returned slot stays valid for the frame's lifetime, its payload is the variable's storage
+	Value *getDeclVal(Decl *decl)
 	{
-		assert(mVars.find(decl) != mVars.end());
-		return mVars.find(decl)->second;
+		return &mSlots[mLayout->declSlot(decl)];
 	}
 	bool hasDeclVal(Decl *decl)
 	{
-		return mVars.find(decl) != mVars.end();
+		return mLayout->hasDecl(decl);
 	}
 
-	void bindStmt(Stmt *stmt, Object* val)
+	const FunctionLayout *getLayout()
 	{
-		if(hasStmtVal(stmt)){
-			delete mExprs[stmt];
-		}
-		mExprs[stmt] = val;
+		return mLayout;
 	}
-	Object* getStmtVal(Stmt *stmt)
+	Value *getSlot(unsigned slot)
 	{
-		assert(mExprs.find(stmt) != mExprs.end());
-		return mExprs[stmt];
+		return &mSlots[slot];
+	}
+	void bindStmt(Stmt *stmt, const Value &val)
+	{
+		mSlots[mLayout->stmtSlot(stmt)] = val;
+	}
+	const Value &getStmtVal(Stmt *stmt)
+	{
+		return mSlots[mLayout->stmtSlot(stmt)];
 	}
 
 	bool hasStmtVal(Stmt *stmt)
 	{
-		return mExprs.find(stmt) != mExprs.end();
+		return mLayout->hasStmt(stmt) && !mSlots[mLayout->stmtSlot(stmt)].isNull();
 	}
 	void setPC(Stmt *stmt)
 	{
@@ -60,14 +86,10 @@ public:
 	{
 		return mPC;
 	}
-	bool hasReturn(){
-		return _hasReturn;
-	}
-	void setReturn(Object* returnVal){
-		this->_hasReturn = true;
+	void setReturn(const Value &returnVal){
 		this->_returnVal = returnVal;
 	}
-	Object* getReturn(){
+	const Value &getReturn(){
 		return _returnVal;
 	}
 
@@ -1,27 +1,52 @@
 #pragma once
 
+#include <vector>
+
 #include "clang/AST/Decl.h"
-#include "Object.h"
+#include "llvm/ADT/DenseMap.h"
+#include "Value.h"
 
 using namespace clang;
 
+/// The static segment: every global variable owns one slot of a single
+/// contiguous Value array, addressed by the index handed out at binding.
+/// All globals are bound before main starts, so slot addresses are stable
+/// for the whole run.
 class StaticFrame
 {
-	std::map<Decl *, Object*> globalVars;
+	llvm::DenseMap<const Decl *, unsigned> mIndex;
+	std::vector<Value> mSlots;
 
 public:
-	StaticFrame() : globalVars() {}
-	void bindDecl(Decl *decl, Object* val)
+	StaticFrame() : mIndex(), mSlots() {}
+	void bindDecl(Decl *decl, const Value &val)
+	{
+		llvm::DenseMap<const Decl *, unsigned>::iterator it = mIndex.find(decl);
+		if (it != mIndex.end())
+		{
+			mSlots[it->second] = val;
+			return;
+		}
+		mIndex[decl] = mSlots.size();
+		mSlots.push_back(val);
+	}
+	Value *getDeclVal(Decl *decl)
+	{
+		return getSlot(declIndex(decl));
+	}
+	bool hasDeclVal(const Decl *decl) const
 	{
-		globalVars[decl] = val;
+		return mIndex.count(decl) != 0;
 	}
-	Object* getDeclVal(Decl *decl)
+	unsigned declIndex(const Decl *decl) const
 	{
-		assert(globalVars.find(decl) != globalVars.end());
-		return globalVars.find(decl)->second;
+		llvm::DenseMap<const Decl *, unsigned>::const_iterator it = mIndex.find(decl);
+		assert(it != mIndex.end());
+		return it->second;
 	}
-	bool hasDeclVal(Decl *decl)
+	Value *getSlot(unsigned index)
 	{
-		return globalVars.find(decl) != globalVars.end();
+		assert(index < mSlots.size());
+		return &mSlots[index];
 	}
-};
\ No newline at end of file
+};
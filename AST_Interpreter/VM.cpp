@@ -0,0 +1,645 @@
+#include "VM.h"
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "VectorKernels.h"
+
+VM::VM(const Program &program, GuestIO &io, const Options &options)
+    : mProgram(program), mIO(io), mOptions(options), mGlobals(program.globals), mHeap(options.heapBytes), mRegisters(nullptr), mTop(0), mNativeStackLimit(0), mVectorRuns(0), mVectorDeclined(0),
+      mStates(program.functions.size())
+{
+    void *region = mmap(nullptr, mOptions.stackBudget, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED)
+        llvm::report_fatal_error("cannot reserve the guest stack");
+    mRegisters = (Slot *)region;
+    if (mOptions.superinstructionStats)
+        mFired.assign(OP_COUNT, 0);
+    if (mOptions.memoize)
+    {
+        for (const CompiledFunction &fn : mProgram.functions)
+            if (fn.memoizable)
+            {
+                mMemo.reset(new MemoTable(mProgram.functions.size()));
+                break;
+            }
+    }
+
+    if (mOptions.jit != JIT_OFF)
+    {
+        mJIT.reset(new JIT(*this, mProgram, mGlobals.data()));
+        if (!mJIT->isValid())
+            mJIT.reset();
+    }
+}
+
+VM::~VM()
+{
+    munmap(mRegisters, mOptions.stackBudget);
+}
+
+void VM::run()
+{
+    if (mProgram.entry < 0)
+        return;
+    if (mOptions.jit == JIT_ALWAYS)
+        compileAll();
+    mTop = 0;
+    if (!mJIT)
+        call(mProgram.entry, nullptr);
+    else
+        runOnGuestStack();
+    bool memoStats = mMemo && mOptions.memoStats;
+    if (mOptions.superinstructionStats || memoStats || mOptions.heapStats || mOptions.vectorStats)
+    {
+        // keep the reports after the guest's own output
+        mIO.flush();
+        if (mOptions.superinstructionStats)
+            reportSuperinstructions();
+        if (memoStats)
+            reportMemo();
+        if (mOptions.heapStats)
+            mHeap.report(llvm::errs());
+        if (mOptions.vectorStats)
+            llvm::errs() << "vector loops : " << mVectorRuns << " run with " << vectorInstructionSet() << " kernels, "
+                         << mVectorDeclined << " left to the scalar loop\n";
+    }
+}
+
+void VM::compileAll()
+{
+    if (!mJIT)
+        return;
+    // one module, so every call between guest functions is direct
+    std::vector<int32_t> all;
+    for (size_t i = 0; i < mStates.size(); ++i)
+        if (!mStates[i].compileTried)
+            all.push_back(i);
+    if (all.empty())
+        return;
+    std::vector<JIT::NativeFunction> natives;
+    if (mJIT->compile(all, natives))
+    {
+        for (size_t i = 0; i < natives.size(); ++i)
+            mStates[all[i]].native = natives[i];
+    }
+    for (int32_t index : all)
+        mStates[index].compileTried = true;
+}
+
+void VM::runOnGuestStack()
+{
+    // native code recurses on the host stack, so run the guest on a stack of
+    // the same budget; compiled functions check mNativeStackLimit on entry
+    const size_t reserve = 1 << 20;
+    void *stack = mmap(nullptr, mOptions.stackBudget, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    mNativeStackLimit = (uintptr_t)stack + reserve;
+    if (stack != MAP_FAILED && mOptions.stackBudget > 2 * reserve &&
+        pthread_attr_setstack(&attr, stack, mOptions.stackBudget) == 0 &&
+        pthread_create(&thread, &attr, &VM::runEntry, this) == 0)
+        pthread_join(thread, nullptr);
+    else
+    {
+        mNativeStackLimit = 0;
+        call(mProgram.entry, nullptr);
+    }
+    pthread_attr_destroy(&attr);
+    if (stack != MAP_FAILED)
+        munmap(stack, mOptions.stackBudget);
+    mNativeStackLimit = 0;
+}
+
+void *VM::runEntry(void *vm)
+{
+    VM *self = (VM *)vm;
+    self->call(self->mProgram.entry, nullptr);
+    return nullptr;
+}
+
+Slot VM::call(int32_t index, const Slot *args)
+{
+    Slot ret;
+    MemoTable::Ticket ticket;
+    if (memoizes(index) && recall(index, args, ret, ticket))
+        return ret;
+    FunctionState &state = mStates[index];
+    if (!state.native && mJIT)
+        heat(index);
+    if (state.native)
+        ret.u = state.native(args);
+    else
+        ret = execute(index, args);
+    if (ticket.entry)
+        mMemo->complete(ticket, ret.i);
+    return ret;
+}
+
+void VM::enter(int32_t index, const Slot *args, int32_t dst, const Instr *returnIp)
+{
+    const CompiledFunction &callee = mProgram.functions[index];
+    size_t base = mTop;
+    if ((base + callee.numRegs) * sizeof(Slot) + (mActivations.size() + 1) * sizeof(Activation) > mOptions.stackBudget)
+        llvm::report_fatal_error("guest stack overflow, raise -stack-budget");
+    std::copy(args, args + callee.numParams, mRegisters + base);
+    mTop = base + callee.numRegs;
+
+    Activation activation;
+    activation.function = index;
+    activation.dst = dst;
+    activation.base = base;
+    activation.returnIp = returnIp;
+    // local arrays live in the arena until this call returns
+    activation.mark = mArena.mark();
+    activation.arrays = callee.frameBytes ? (char *)mArena.allocate(callee.frameBytes) : nullptr;
+    mActivations.push_back(activation);
+}
+
+void VM::heat(int32_t index)
+{
+    FunctionState &state = mStates[index];
+    if (++state.hotness < mOptions.jitThreshold || state.compileTried)
+        return;
+    state.compileTried = true;
+    std::vector<int32_t> functions(1, index);
+    std::vector<JIT::NativeFunction> natives;
+    if (mJIT->compile(functions, natives))
+        state.native = natives[0];
+}
+
+bool VM::recall(int32_t index, const Slot *args, Slot &ret, MemoTable::Ticket &ticket)
+{
+    const CompiledFunction &callee = mProgram.functions[index];
+    int32_t key[MemoTable::MAX_ARGS];
+    for (uint32_t i = 0; i < callee.numParams; ++i)
+        key[i] = args[i].i;
+    int32_t result;
+    if (!mMemo->lookup(index, key, callee.numParams, result, ticket))
+        return false;
+    ret.u = (uint64_t)(int64_t)result;
+    return true;
+}
+
+void VM::reportMemo()
+{
+    std::vector<std::string> names;
+    for (const CompiledFunction &fn : mProgram.functions)
+        names.push_back(fn.name);
+    mMemo->report(llvm::errs(), names);
+}
+
+void VM::reportSuperinstructions()
+{
+    std::vector<uint64_t> emitted(OP_COUNT, 0);
+    for (const CompiledFunction &fn : mProgram.functions)
+        for (const Instr &in : fn.code)
+            ++emitted[in.op];
+    llvm::raw_ostream &os = llvm::errs();
+    os << "superinstruction     emitted           fired\n";
+    for (int op = 0; op < OP_COUNT; ++op)
+    {
+        if (!isSuperinstruction((Opcode)op) || (emitted[op] == 0 && mFired[op] == 0))
+            continue;
+        os << llvm::left_justify(opcodeName((Opcode)op), 16) << llvm::format_decimal(emitted[op], 12)
+           << llvm::format_decimal(mFired[op], 16) << "\n";
+    }
+}
+
+bool VM::vectorLoop(const VectorLoop &loop, Slot *regs)
+{
+    if (runVectorLoop(loop, regs))
+    {
+        ++mVectorRuns;
+        return true;
+    }
+    ++mVectorDeclined;
+    return false;
+}
+
+int32_t VM::input()
+{
+    return mIO.get();
+}
+
+void VM::output(int32_t val)
+{
+    mIO.print(val);
+}
+
+/// int32 arithmetic wraps like the host hardware does instead of being UB
+static inline int32_t wrap(uint32_t val)
+{
+    return (int32_t)val;
+}
+
+Slot VM::execute(int32_t index, const Slot *args)
+{
+    // calls made from here on are resolved in this loop, the ones native
+    // code makes come back through call() and nest
+    size_t entryDepth = mActivations.size();
+    enter(index, args, -1, nullptr);
+
+    char *globals = mGlobals.data();
+    uint64_t *fired = fireCounts();
+    // cached state of the innermost activation
+    int32_t current;
+    char *arrays;
+    Slot *regs;
+    const Instr *code;
+    const Instr *ip;
+    auto reload = [&]() {
+        const Activation &activation = mActivations.back();
+        current = activation.function;
+        arrays = activation.arrays;
+        regs = mRegisters + activation.base;
+        code = mProgram.functions[current].code.data();
+    };
+    reload();
+    ip = code;
+
+// superinstructions count themselves when asked to; a branch to an earlier
+// pc closes a loop and heats the function
+#define FIRED()    \
+    if (fired)     \
+    ++fired[in.op]
+#define BRANCH(pc)                          \
+    do                                      \
+    {                                       \
+        if (mJIT && code + (pc) < ip)       \
+            heat(current);                  \
+        ip = code + (pc);                   \
+    } while (0)
+
+    for (;;)
+    {
+        const Instr &in = *ip++;
+        switch (in.op)
+        {
+        case OP_NOP:
+            break;
+        case OP_MOV:
+            regs[in.a] = regs[in.b];
+            break;
+        case OP_LOADI:
+            regs[in.a].u = (uint64_t)(int64_t)in.b;
+            break;
+
+        case OP_ADD_I:
+            regs[in.a].i = wrap((uint32_t)regs[in.b].i + (uint32_t)regs[in.c].i);
+            break;
+        case OP_SUB_I:
+            regs[in.a].i = wrap((uint32_t)regs[in.b].i - (uint32_t)regs[in.c].i);
+            break;
+        case OP_MUL_I:
+            regs[in.a].i = wrap((uint32_t)regs[in.b].i * (uint32_t)regs[in.c].i);
+            break;
+        case OP_DIV_I:
+            regs[in.a].i = regs[in.b].i / regs[in.c].i;
+            break;
+        case OP_REM_I:
+            regs[in.a].i = regs[in.b].i % regs[in.c].i;
+            break;
+        case OP_NEG_I:
+            regs[in.a].i = wrap(0u - (uint32_t)regs[in.b].i);
+            break;
+        case OP_NOT_B:
+            regs[in.a].i = !regs[in.b].i;
+            break;
+        case OP_NEZ_I:
+            regs[in.a].i = regs[in.b].i != 0;
+            break;
+        case OP_NEZ_P:
+            regs[in.a].i = regs[in.b].u != 0;
+            break;
+
+        case OP_ADD_U:
+            regs[in.a].u = regs[in.b].u + regs[in.c].u;
+            break;
+        case OP_SUB_U:
+            regs[in.a].u = regs[in.b].u - regs[in.c].u;
+            break;
+        case OP_MUL_U:
+            regs[in.a].u = regs[in.b].u * regs[in.c].u;
+            break;
+        case OP_DIV_U:
+            regs[in.a].u = regs[in.b].u / regs[in.c].u;
+            break;
+
+        case OP_EQ_I:
+            regs[in.a].i = regs[in.b].i == regs[in.c].i;
+            break;
+        case OP_NE_I:
+            regs[in.a].i = regs[in.b].i != regs[in.c].i;
+            break;
+        case OP_LT_I:
+            regs[in.a].i = regs[in.b].i < regs[in.c].i;
+            break;
+        case OP_GT_I:
+            regs[in.a].i = regs[in.b].i > regs[in.c].i;
+            break;
+        case OP_LE_I:
+            regs[in.a].i = regs[in.b].i <= regs[in.c].i;
+            break;
+        case OP_GE_I:
+            regs[in.a].i = regs[in.b].i >= regs[in.c].i;
+            break;
+        case OP_EQ_U:
+            regs[in.a].i = regs[in.b].u == regs[in.c].u;
+            break;
+        case OP_NE_U:
+            regs[in.a].i = regs[in.b].u != regs[in.c].u;
+            break;
+        case OP_LT_U:
+            regs[in.a].i = regs[in.b].u < regs[in.c].u;
+            break;
+        case OP_GT_U:
+            regs[in.a].i = regs[in.b].u > regs[in.c].u;
+            break;
+        case OP_LE_U:
+            regs[in.a].i = regs[in.b].u <= regs[in.c].u;
+            break;
+        case OP_GE_U:
+            regs[in.a].i = regs[in.b].u >= regs[in.c].u;
+            break;
+
+        case OP_I2U:
+            regs[in.a].u = (uint64_t)(int64_t)regs[in.b].i;
+            break;
+        case OP_U2I:
+            regs[in.a].i = (int32_t)regs[in.b].u;
+            break;
+        case OP_I2C:
+            regs[in.a].i = (int8_t)regs[in.b].i;
+            break;
+        case OP_PADD:
+            regs[in.a].p = (char *)regs[in.b].p + (int64_t)regs[in.c].i * in.scale;
+            break;
+        case OP_PSUB:
+            regs[in.a].p = (char *)regs[in.b].p - (int64_t)regs[in.c].i * in.scale;
+            break;
+
+        case OP_LOAD8:
+            regs[in.a].i = *(int8_t *)regs[in.b].p;
+            break;
+        case OP_LOAD32:
+            regs[in.a].i = *(int32_t *)regs[in.b].p;
+            break;
+        case OP_LOAD64:
+            regs[in.a].u = *(uint64_t *)regs[in.b].p;
+            break;
+        case OP_STORE8:
+            *(int8_t *)regs[in.b].p = regs[in.a].i;
+            break;
+        case OP_STORE32:
+            *(int32_t *)regs[in.b].p = regs[in.a].i;
+            break;
+        case OP_STORE64:
+            *(uint64_t *)regs[in.b].p = regs[in.a].u;
+            break;
+        case OP_LOADG8:
+            regs[in.a].i = *(int8_t *)(globals + in.b);
+            break;
+        case OP_LOADG32:
+            regs[in.a].i = *(int32_t *)(globals + in.b);
+            break;
+        case OP_LOADG64:
+            regs[in.a].u = *(uint64_t *)(globals + in.b);
+            break;
+        case OP_STOREG8:
+            *(int8_t *)(globals + in.b) = regs[in.a].i;
+            break;
+        case OP_STOREG32:
+            *(int32_t *)(globals + in.b) = regs[in.a].i;
+            break;
+        case OP_STOREG64:
+            *(uint64_t *)(globals + in.b) = regs[in.a].u;
+            break;
+        case OP_ADDRG:
+            regs[in.a].p = globals + in.b;
+            break;
+        case OP_ADDRL:
+            regs[in.a].p = arrays + in.b;
+            break;
+
+        case OP_JMP:
+            if (mJIT && code + in.a < ip)
+                heat(current);
+            ip = code + in.a;
+            break;
+        case OP_JT:
+            if (regs[in.a].i)
+            {
+                // loops are laid out with the conditional back-edge at the bottom
+                if (mJIT && code + in.b < ip)
+                    heat(current);
+                ip = code + in.b;
+            }
+            break;
+        case OP_JF:
+            if (!regs[in.a].i)
+                ip = code + in.b;
+            break;
+
+        case OP_TAILCALL:
+        {
+            FunctionState &state = mStates[in.b];
+            if (!state.native && mJIT)
+                heat(in.b);
+            // the memo table and native code answer like CALL, the RET that follows returns it
+            if (memoizes(in.b) || state.native)
+                goto call;
+            // the callee takes over this activation: same return point, same
+            // destination, its window starts where the caller's did
+            Activation &activation = mActivations.back();
+            const CompiledFunction &callee = mProgram.functions[in.b];
+            if ((activation.base + callee.numRegs) * sizeof(Slot) + mActivations.size() * sizeof(Activation) >
+                mOptions.stackBudget)
+                llvm::report_fatal_error("guest stack overflow, raise -stack-budget");
+            // arguments sit in temporaries above the parameters
+            std::memmove(regs, regs + in.c, callee.numParams * sizeof(Slot));
+            mTop = activation.base + callee.numRegs;
+            mArena.release(activation.mark);
+            activation.arrays = callee.frameBytes ? (char *)mArena.allocate(callee.frameBytes) : nullptr;
+            activation.function = in.b;
+            reload();
+            ip = code;
+            break;
+        }
+        case OP_CALL:
+        call:
+        {
+            Slot ret;
+            MemoTable::Ticket ticket;
+            if (memoizes(in.b) && recall(in.b, regs + in.c, ret, ticket))
+            {
+                if (in.a >= 0)
+                    regs[in.a] = ret;
+                break;
+            }
+            FunctionState &state = mStates[in.b];
+            if (!state.native && mJIT)
+                heat(in.b);
+            if (state.native)
+            {
+                ret.u = state.native(regs + in.c);
+                if (ticket.entry)
+                    mMemo->complete(ticket, ret.i);
+                if (in.a >= 0)
+                    regs[in.a] = ret;
+                break;
+            }
+            enter(in.b, regs + in.c, in.a, ip);
+            mActivations.back().memo = ticket;
+            reload();
+            ip = code;
+            break;
+        }
+        case OP_RET:
+        case OP_RETV:
+        {
+            Slot ret;
+            if (in.op == OP_RET)
+                ret = regs[in.a];
+            else
+                ret.u = 0;
+            Activation done = mActivations.back();
+            mActivations.pop_back();
+            mArena.release(done.mark);
+            mTop = done.base;
+            if (done.memo.entry)
+                mMemo->complete(done.memo, ret.i);
+            if (mActivations.size() == entryDepth)
+                return ret;
+            reload();
+            ip = done.returnIp;
+            if (done.dst >= 0)
+                regs[done.dst] = ret;
+            break;
+        }
+
+        case OP_GET:
+            regs[in.a].i = input();
+            break;
+        case OP_PRINT:
+            output(regs[in.a].i);
+            break;
+        case OP_MALLOC:
+            regs[in.a].p = mHeap.allocate(regs[in.b].i);
+            break;
+        case OP_FREE:
+            mHeap.free(regs[in.a].p);
+            break;
+        case OP_VLOOP:
+            if (vectorLoop(mProgram.functions[current].loops[in.a], regs))
+                ip = code + in.b;
+            break;
+
+        case OP_ADDK_I:
+            FIRED();
+            regs[in.a].i = wrap((uint32_t)regs[in.b].i + (uint32_t)in.c);
+            break;
+        case OP_JEQ_I:
+            FIRED();
+            if (regs[in.a].i == regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JNE_I:
+            FIRED();
+            if (regs[in.a].i != regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JLT_I:
+            FIRED();
+            if (regs[in.a].i < regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JGT_I:
+            FIRED();
+            if (regs[in.a].i > regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JLE_I:
+            FIRED();
+            if (regs[in.a].i <= regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JGE_I:
+            FIRED();
+            if (regs[in.a].i >= regs[in.b].i)
+                BRANCH(in.c);
+            break;
+        case OP_JEQK_I:
+            FIRED();
+            if (regs[in.a].i == in.b)
+                BRANCH(in.c);
+            break;
+        case OP_JNEK_I:
+            FIRED();
+            if (regs[in.a].i != in.b)
+                BRANCH(in.c);
+            break;
+        case OP_JLTK_I:
+            FIRED();
+            if (regs[in.a].i < in.b)
+                BRANCH(in.c);
+            break;
+        case OP_JGTK_I:
+            FIRED();
+            if (regs[in.a].i > in.b)
+                BRANCH(in.c);
+            break;
+        case OP_JLEK_I:
+            FIRED();
+            if (regs[in.a].i <= in.b)
+                BRANCH(in.c);
+            break;
+        case OP_JGEK_I:
+            FIRED();
+            if (regs[in.a].i >= in.b)
+                BRANCH(in.c);
+            break;
+        case OP_LOADX8:
+            FIRED();
+            regs[in.a].i = ((int8_t *)regs[in.b].p)[regs[in.c].i];
+            break;
+        case OP_LOADX32:
+            FIRED();
+            regs[in.a].i = ((int32_t *)regs[in.b].p)[regs[in.c].i];
+            break;
+        case OP_LOADX64:
+            FIRED();
+            regs[in.a].u = ((uint64_t *)regs[in.b].p)[regs[in.c].i];
+            break;
+        case OP_STOREX8:
+            FIRED();
+            ((int8_t *)regs[in.b].p)[regs[in.c].i] = regs[in.a].i;
+            break;
+        case OP_STOREX32:
+            FIRED();
+            ((int32_t *)regs[in.b].p)[regs[in.c].i] = regs[in.a].i;
+            break;
+        case OP_STOREX64:
+            FIRED();
+            ((uint64_t *)regs[in.b].p)[regs[in.c].i] = regs[in.a].u;
+            break;
+
+        default:
+            assert(0);
+        }
+    }
+#undef FIRED
+#undef BRANCH
+}
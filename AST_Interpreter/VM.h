@@ -0,0 +1,149 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Bytecode.h"
+#include "FrameArena.h"
+#include "GuestHeap.h"
+#include "GuestIO.h"
+#include "JIT.h"
+#include "MemoTable.h"
+
+/// Executes a Program produced by BytecodeCompiler.
+/// Guest calls never recurse on the host stack: every active call is an
+/// Activation on an explicit stack, and the registers of all of them live in
+/// one region reserved up front, a callee's window starting right after its
+/// caller's. Frame storage never moves, depth is bounded only by the budget.
+class VM
+{
+public:
+    enum JitMode
+    {
+        JIT_OFF,    // interpret only
+        JIT_TIERED, // compile a function once it gets hot
+        JIT_ALWAYS  // compile every function before main runs
+    };
+    struct Options
+    {
+        JitMode jit;
+        /// calls plus loop back-edges before a function is compiled
+        uint32_t jitThreshold;
+        /// bytes of registers plus activations the guest may use
+        size_t stackBudget;
+        /// count executed superinstructions and report them after run()
+        bool superinstructionStats;
+        /// answer calls of memoizable functions from a MemoTable
+        bool memoize;
+        /// report memo hits and misses per function after run()
+        bool memoStats;
+        /// bytes of address space reserved for MALLOC
+        size_t heapBytes;
+        /// report guest heap usage after run()
+        bool heapStats;
+        /// report how often VLOOP ran its vector kernels after run()
+        bool vectorStats;
+
+        Options() : jit(JIT_TIERED), jitThreshold(1000), stackBudget((size_t)1 << 30), superinstructionStats(false),
+                    memoize(true), memoStats(false), heapBytes((size_t)4 << 30), heapStats(false), vectorStats(false) {}
+    };
+
+    VM(const Program &program, GuestIO &io, const Options &options = Options());
+    ~VM();
+    VM(const VM &) = delete;
+    VM &operator=(const VM &) = delete;
+    /// Run main
+    void run();
+    /// Compile every function now, as run() does under JIT_ALWAYS. A host
+    /// forking a process per run calls this once before forking, so every
+    /// child starts with the native code. Does nothing under JIT_OFF.
+    void compileAll();
+
+    /// Call function index with numParams argument slots, native code if it has any
+    Slot call(int32_t index, const Slot *args);
+    /// VLOOP : true if the vector kernels ran loop on the registers regs
+    bool vectorLoop(const VectorLoop &loop, Slot *regs);
+    /// The GET / PRINT builtins
+    int32_t input();
+    void output(int32_t val);
+    GuestHeap &heap()
+    {
+        return mHeap;
+    }
+    /// native code must not grow the host stack below this address
+    const uintptr_t *nativeStackLimit() const
+    {
+        return &mNativeStackLimit;
+    }
+    /// per opcode execution counters of superinstructions, nullptr when not counting
+    uint64_t *fireCounts()
+    {
+        return mFired.empty() ? nullptr : mFired.data();
+    }
+    /// calls of index go through the memo table, native code must not call it directly
+    bool memoizes(int32_t index) const
+    {
+        return mMemo && mProgram.functions[index].memoizable;
+    }
+
+private:
+    /// per function tiering state
+    struct FunctionState
+    {
+        uint32_t hotness = 0;
+        bool compileTried = false;
+        JIT::NativeFunction native = nullptr;
+    };
+    /// one interpreted call in progress
+    struct Activation
+    {
+        int32_t function;
+        /// caller register receiving the result, -1 if unused
+        int32_t dst;
+        size_t base;
+        char *arrays;
+        /// where the caller resumes
+        const Instr *returnIp;
+        FrameArena::Mark mark;
+        /// memo entry the result goes to, if the call missed the table
+        MemoTable::Ticket memo;
+    };
+
+    const Program &mProgram;
+    GuestIO &mIO;
+    Options mOptions;
+    std::vector<char> mGlobals;
+    GuestHeap mHeap;
+    /// stackBudget bytes, committed by the OS only as they are touched
+    Slot *mRegisters;
+    /// first register past the innermost interpreted frame
+    size_t mTop;
+    std::vector<Activation> mActivations;
+    /// 0 while the guest runs on the ordinary host stack
+    uintptr_t mNativeStackLimit;
+    /// storage of local arrays, one LIFO block per active call
+    FrameArena mArena;
+    std::vector<FunctionState> mStates;
+    std::unique_ptr<JIT> mJIT;
+    std::vector<uint64_t> mFired;
+    /// null unless memoizing and some function is memoizable
+    std::unique_ptr<MemoTable> mMemo;
+    /// VLOOP executions the kernels ran and the ones left to the scalar loop
+    uint64_t mVectorRuns;
+    uint64_t mVectorDeclined;
+
+    /// interpret function index until it returns, calls it makes included
+    Slot execute(int32_t index, const Slot *args);
+    /// run main on a thread whose stack is as large as the budget
+    void runOnGuestStack();
+    static void *runEntry(void *vm);
+    /// push an activation of index, its parameters copied from args
+    void enter(int32_t index, const Slot *args, int32_t dst, const Instr *returnIp);
+    /// count one call or back-edge, compile the function past the threshold
+    void heat(int32_t index);
+    /// true and ret set if the memo table answers a call of index,
+    /// otherwise ticket reserves the entry for its result
+    bool recall(int32_t index, const Slot *args, Slot &ret, MemoTable::Ticket &ticket);
+    void reportSuperinstructions();
+    void reportMemo();
+};
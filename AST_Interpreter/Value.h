@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+/// A scalar interpreter value, stored inline in a 16 byte tagged slot.
+/// Binding, copying or overwriting a Value never touches the heap; only
+/// array storage (see Object) is allocated.
+class Value
+{
+public:
+    enum TAG
+    {
+        EMPTY,
+        INT32,
+        UINT64,
+        BOOL,
+        POINTER
+    };
+    Value() : _u(0), _type(EMPTY){};
+    Value(bool val) : _u(0), _type(BOOL) { _b = val; };
+    Value(int val) : _u(0), _type(INT32) { _i = val; };
+    Value(uint64_t val) : _u(val), _type(UINT64){};
+    Value(void *pointer) : _p(pointer), _type(POINTER){};
+
+    bool isNull() const
+    {
+        return _type == EMPTY;
+    };
+    bool isInt32() const
+    {
+        return _type == INT32;
+    }
+    bool isUInt64() const
+    {
+        return _type == UINT64;
+    }
+    int32_t getInt32() const
+    {
+        assert(_type == INT32);
+        return _i;
+    };
+    uint64_t getUInt64() const
+    {
+        assert(_type == UINT64);
+        return _u;
+    };
+    bool getBool() const
+    {
+        assert(_type == BOOL);
+        return _b;
+    };
+    void *getPointer() const
+    {
+        assert(_type == POINTER);
+        return _p;
+    }
+    /// Address of the payload, the storage a variable bound to this slot
+    /// is read and written through.
+    void *getAddress()
+    {
+        return &_u;
+    }
+
+private:
+    union
+    {
+        int32_t _i;
+        uint64_t _u;
+        bool _b;
+        void *_p;
+    };
+    TAG _type;
+};
+
+static_assert(sizeof(Value) == 16, "Value must stay a 16 byte slot");
@@ -0,0 +1,184 @@
+#include "VectorKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VECTOR_X86 1
+#endif
+
+namespace
+{
+/// shorter loops are left to the scalar code
+const int32_t MIN_TRIP = 16;
+
+/// dst[i] = lhs op rhs for i in [from, to); a null array operand is the scalar instead
+typedef void (*MapKernel)(int32_t *dst, const int32_t *lhs, int32_t lhsScalar, const int32_t *rhs, int32_t rhsScalar,
+                          int32_t from, int32_t to);
+/// wrapping sum of src[from, to)
+typedef int32_t (*SumKernel)(const int32_t *src, int32_t from, int32_t to);
+
+struct Kernels
+{
+    const char *name;
+    /// indexed by VectorLoop::Op
+    MapKernel map[3];
+    SumKernel sum;
+};
+
+/// guest int arithmetic wraps, so it is done on uint32_t
+template <VectorLoop::Op Op>
+inline uint32_t apply(uint32_t lhs, uint32_t rhs)
+{
+    return Op == VectorLoop::ADD ? lhs + rhs : Op == VectorLoop::SUB ? lhs - rhs : lhs * rhs;
+}
+
+template <VectorLoop::Op Op>
+void mapScalar(int32_t *dst, const int32_t *lhs, int32_t lhsScalar, const int32_t *rhs, int32_t rhsScalar,
+               int32_t from, int32_t to)
+{
+    for (int32_t i = from; i < to; ++i)
+        dst[i] = (int32_t)apply<Op>(lhs ? lhs[i] : lhsScalar, rhs ? rhs[i] : rhsScalar);
+}
+
+int32_t sumScalar(const int32_t *src, int32_t from, int32_t to)
+{
+    uint32_t sum = 0;
+    for (int32_t i = from; i < to; ++i)
+        sum += (uint32_t)src[i];
+    return (int32_t)sum;
+}
+
+const Kernels scalarKernels = {"scalar", {&mapScalar<VectorLoop::ADD>, &mapScalar<VectorLoop::SUB>, &mapScalar<VectorLoop::MUL>}, &sumScalar};
+
+#ifdef VECTOR_X86
+template <VectorLoop::Op Op>
+__attribute__((target("sse4.1"))) inline __m128i apply128(__m128i lhs, __m128i rhs)
+{
+    return Op == VectorLoop::ADD ? _mm_add_epi32(lhs, rhs) : Op == VectorLoop::SUB ? _mm_sub_epi32(lhs, rhs) : _mm_mullo_epi32(lhs, rhs);
+}
+
+template <VectorLoop::Op Op>
+__attribute__((target("sse4.1"))) void mapSSE(int32_t *dst, const int32_t *lhs, int32_t lhsScalar, const int32_t *rhs,
+                                              int32_t rhsScalar, int32_t from, int32_t to)
+{
+    __m128i lhsSplat = _mm_set1_epi32(lhsScalar);
+    __m128i rhsSplat = _mm_set1_epi32(rhsScalar);
+    int32_t i = from;
+    for (; i + 4 <= to; i += 4)
+    {
+        __m128i l = lhs ? _mm_loadu_si128((const __m128i *)(lhs + i)) : lhsSplat;
+        __m128i r = rhs ? _mm_loadu_si128((const __m128i *)(rhs + i)) : rhsSplat;
+        _mm_storeu_si128((__m128i *)(dst + i), apply128<Op>(l, r));
+    }
+    mapScalar<Op>(dst, lhs, lhsScalar, rhs, rhsScalar, i, to);
+}
+
+__attribute__((target("sse4.1"))) int32_t sumSSE(const int32_t *src, int32_t from, int32_t to)
+{
+    __m128i acc = _mm_setzero_si128();
+    int32_t i = from;
+    for (; i + 4 <= to; i += 4)
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i *)(src + i)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (int32_t)((uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)sumScalar(src, i, to));
+}
+
+template <VectorLoop::Op Op>
+__attribute__((target("avx2"))) inline __m256i apply256(__m256i lhs, __m256i rhs)
+{
+    return Op == VectorLoop::ADD ? _mm256_add_epi32(lhs, rhs)
+                                 : Op == VectorLoop::SUB ? _mm256_sub_epi32(lhs, rhs) : _mm256_mullo_epi32(lhs, rhs);
+}
+
+template <VectorLoop::Op Op>
+__attribute__((target("avx2"))) void mapAVX2(int32_t *dst, const int32_t *lhs, int32_t lhsScalar, const int32_t *rhs,
+                                             int32_t rhsScalar, int32_t from, int32_t to)
+{
+    __m256i lhsSplat = _mm256_set1_epi32(lhsScalar);
+    __m256i rhsSplat = _mm256_set1_epi32(rhsScalar);
+    int32_t i = from;
+    for (; i + 8 <= to; i += 8)
+    {
+        __m256i l = lhs ? _mm256_loadu_si256((const __m256i *)(lhs + i)) : lhsSplat;
+        __m256i r = rhs ? _mm256_loadu_si256((const __m256i *)(rhs + i)) : rhsSplat;
+        _mm256_storeu_si256((__m256i *)(dst + i), apply256<Op>(l, r));
+    }
+    mapScalar<Op>(dst, lhs, lhsScalar, rhs, rhsScalar, i, to);
+}
+
+__attribute__((target("avx2"))) int32_t sumAVX2(const int32_t *src, int32_t from, int32_t to)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int32_t i = from;
+    for (; i + 8 <= to; i += 8)
+        acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i *)(src + i)));
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (int32_t)((uint32_t)_mm_cvtsi128_si32(half) + (uint32_t)sumScalar(src, i, to));
+}
+
+const Kernels sseKernels = {"sse4.1", {&mapSSE<VectorLoop::ADD>, &mapSSE<VectorLoop::SUB>, &mapSSE<VectorLoop::MUL>}, &sumSSE};
+const Kernels avx2Kernels = {"avx2", {&mapAVX2<VectorLoop::ADD>, &mapAVX2<VectorLoop::SUB>, &mapAVX2<VectorLoop::MUL>}, &sumAVX2};
+#endif
+
+const Kernels &selectKernels()
+{
+#ifdef VECTOR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return avx2Kernels;
+    if (__builtin_cpu_supports("sse4.1"))
+        return sseKernels;
+#endif
+    return scalarKernels;
+}
+
+const Kernels &kernels = selectKernels();
+
+inline int32_t valueOf(const VectorOperand &operand, const Slot *regs)
+{
+    return operand.kind == VectorOperand::IMM ? operand.value : regs[operand.value].i;
+}
+
+inline const int32_t *arrayOf(const VectorOperand &operand, const Slot *regs)
+{
+    return operand.kind == VectorOperand::ARRAY ? (const int32_t *)regs[operand.value].p : nullptr;
+}
+
+/// src[from, to) may be read while dst[from, to) is written only if they
+/// are the same elements or do not meet at all
+inline bool independent(const int32_t *src, const int32_t *dst, int32_t from, int32_t to)
+{
+    return src == nullptr || src == dst || src + to <= dst + from || dst + to <= src + from;
+}
+} // namespace
+
+bool runVectorLoop(const VectorLoop &loop, Slot *regs)
+{
+    int32_t from = regs[loop.counter].i;
+    int32_t to = valueOf(loop.limit, regs);
+    if ((int64_t)to - from < MIN_TRIP)
+        return false;
+
+    const int32_t *lhs = arrayOf(loop.lhs, regs);
+    if (loop.kind == VectorLoop::SUM)
+        regs[loop.dst].i = (int32_t)((uint32_t)regs[loop.dst].i + (uint32_t)kernels.sum(lhs, from, to));
+    else
+    {
+        int32_t *dst = (int32_t *)regs[loop.dst].p;
+        const int32_t *rhs = arrayOf(loop.rhs, regs);
+        if (!independent(lhs, dst, from, to) || !independent(rhs, dst, from, to))
+            return false;
+        int32_t lhsScalar = lhs ? 0 : valueOf(loop.lhs, regs);
+        int32_t rhsScalar = rhs ? 0 : valueOf(loop.rhs, regs);
+        kernels.map[loop.op](dst, lhs, lhsScalar, rhs, rhsScalar, from, to);
+    }
+    regs[loop.counter].i = to;
+    return true;
+}
+
+const char *vectorInstructionSet()
+{
+    return kernels.name;
+}
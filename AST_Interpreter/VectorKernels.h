@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Bytecode.h"
+
+/// Runs a VLOOP with the widest kernels the host supports, AVX2, SSE4.1 or
+/// plain scalar code, picked once from CPU detection at startup.
+/// Returns false, leaving every register and element untouched, when the
+/// loop is too short to pay off or a source array overlaps the destination
+/// at another index; the scalar loop runs instead then.
+bool runVectorLoop(const VectorLoop &loop, Slot *regs);
+
+/// name of the kernel set in use
+const char *vectorInstructionSet();
@@ -28,6 +28,93 @@ cd build && cmake .. -DLLVM_DIR=/usr/local/llvm10ra && make && cd ..
 ./build/ast-interpreter "`cat ./test/test22.c`"
 ./build/ast-interpreter "`cat ./test/test23.c`"
 ./build/ast-interpreter "`cat ./test/test24.c`"
+./build/ast-interpreter "`cat ./test/test25.c`"
+./build/ast-interpreter "`cat ./test/test26.c`"
+./build/ast-interpreter "`cat ./test/test27.c`"
+./build/ast-interpreter "`cat ./test/test28.c`"
+./build/ast-interpreter "`cat ./test/test29.c`"
+./build/ast-interpreter "`cat ./test/test30.c`"
+./build/ast-interpreter "`cat ./test/test31.c`"
+
+# runs test $1 with the flags that follow, complains unless PRINT writes what answer holds
+check() {
+   local n=$1
+   shift
+   local got=`./build/ast-interpreter -print-to=stdout "$@" "\`cat ./test/test$n.c\`"`
+   local expected=`grep "^$n " answer | cut -d' ' -f2`
+   if [ "$got" != "$expected" ]; then
+      echo "test$n $*: printed '$got', expected '$expected'"
+   fi
+}
+
+# the same programs unfolded, on the AST walker and on the VM without the JIT,
+# every run must print what answer holds
+for flags in -fold-constants=false -engine=ast -jit=off; do
+   for n in 00 01 02 03 04 05 06 07 08 09 10 11 12 13 14 15 16 18 19 20 21 22 23 24 25 26 27 28 29 30 31; do
+      ./build/ast-interpreter $flags "`cat ./test/test$n.c`"
+   done
+done
+
+# memo tables must not change what a program prints
+./build/ast-interpreter -memoize=false "`cat ./test/test27.c`"
+./build/ast-interpreter -engine=ast -memoize=false "`cat ./test/test27.c`"
+
+# a million tail calls only fit a 4 MiB guest stack if every call takes over its
+# caller's frame, the walker runs them on the host stack
+./build/ast-interpreter -stack-budget=4 "`cat ./test/test28.c`"
+./build/ast-interpreter -stack-budget=4 -jit=always "`cat ./test/test28.c`"
+./build/ast-interpreter -stack-budget=4 -jit=off "`cat ./test/test28.c`"
+./build/ast-interpreter -engine=ast "`cat ./test/test28.c`"
+
+# many programs in one process with fresh state each, the answers in order
+# followed by one status line per program and a summary, file names also on stdin
+./build/ast-interpreter -batch ./test/test0*.c ./test/test2*.c
+ls ./test/test1*.c ./test/test3*.c | ./build/ast-interpreter -batch
+
+# the vector kernels must agree with the scalar loops they replace
+./build/ast-interpreter -vectorize=false "`cat ./test/test31.c`"
+./build/ast-interpreter -jit=always "`cat ./test/test31.c`"
+
+# GET values from a file, none here so every GET reads 0
+check 32 -batch-io -get-input=/dev/null
+
+# every program in answer compiled once through the library and run from
+# several threads, on the VM and on the walker
+./build/interpreter-test ./answer ./test
+
+# one forked run per line of GET values, the results in input order; -1
+# divides by zero, that child dies after its first PRINT and the rest go on
+expected='1: 3 11
+3: -1 ! signal 8
+4: 0 0
+5: -5 -25
+6: 12 518'
+for flags in -jit=tiered -jit=off -engine=ast; do
+   got=`printf '3 1 2 3\n# skipped\n-1\n\n-5\n12 0 1 2 3 4 5 6 7 8 9 10 11\n' |
+        ./build/ast-interpreter -fork-server=- -fork-jobs=2 $flags "\`cat ./test/test32.c\`"`
+   if [ "$got" != "$expected" ]; then echo "-fork-server $flags: printed '$got', expected '$expected'"; fi
+done
+# the profilers cannot follow the children
+./build/ast-interpreter -fork-server=- -profile=./build/prof "`cat ./test/test32.c`" < /dev/null 2> /dev/null &&
+   echo "-fork-server -profile: not rejected"
+
+# the first run misses the cache and stores the lowered program, the second
+# loads and validates it without clang, both must print the same
+rm -rf ./build/cache
+check 31 -cache-dir=./build/cache
+check 31 -cache-dir=./build/cache
+check 27 -cache-dir=./build/cache
+check 27 -cache-dir=./build/cache
+
+# the instrumented walker must print what the plain run prints, its reports go
+# to stderr or to files sharing one prefix
+rm -f ./build/prof.*
+check 27 -profile=./build/prof -sample-profile=./build/prof -sample-interval=100
+check 29 -perf-counters
+check 29 -mem-stats
+for f in annotated folded samples samples.folded; do
+   test -f ./build/prof.$f || echo "-profile / -sample-profile: ./build/prof.$f missing"
+done
 
 # ./build/ast-interpreter ./test/test00.c
 # ./build/ast-interpreter ./test/test01.c
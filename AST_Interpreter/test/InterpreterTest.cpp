@@ -0,0 +1,131 @@
+// Drives the interpreter library the way an embedder does: every program
+// listed in answer is compiled once, for the VM and for the AST walker, and
+// run from several threads at once. Without GET input the PRINT values must
+// be what answer holds, with a GET vector what a run of the same vector alone
+// printed.
+//
+//     interpreter-test <answer> <test directory>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "Interpreter.h"
+
+static const unsigned THREADS = 4;
+static const unsigned ROUNDS = 2;
+
+/// PRINT values the way answer holds them, concatenated without separator
+static std::string joined(const std::vector<int32_t> &values)
+{
+    std::string text;
+    for (int32_t value : values)
+        text += std::to_string(value);
+    return text;
+}
+
+/// GET vectors every program is run with, the empty one first. Programs that
+/// read no GET values print the same for each, test32 sums a count of them.
+static std::vector<std::vector<int32_t>> vectors()
+{
+    return {{}, {3, 1, 2, 3}, {1, 1 << 20}, {-5}, {6, 9, -9, 8, -8, 7, -7}, {12, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}};
+}
+
+/// runs every vector ROUNDS times, a message per run that printed otherwise
+static void runAll(const CompiledProgram &program, const std::vector<std::string> &expected, const std::string &name,
+                   std::string &failures)
+{
+    std::vector<std::vector<int32_t>> inputs = vectors();
+    std::ostringstream os;
+    for (unsigned round = 0; round < ROUNDS; ++round)
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            std::vector<int32_t> output;
+            program.run(inputs[i], output);
+            if (joined(output) != expected[i])
+                os << name << " vector " << i << ": printed '" << joined(output) << "', expected '" << expected[i]
+                   << "'\n";
+        }
+    failures = os.str();
+}
+
+static bool check(const std::string &number, const std::string &answer, const std::string &source, bool bytecode)
+{
+    Interpreter::Options options;
+    options.bytecode = bytecode;
+    std::string name = "test" + number + (bytecode ? "" : " -engine=ast");
+    std::string error;
+    std::unique_ptr<CompiledProgram> program = Interpreter(options).compile(source, &error);
+    if (!program)
+    {
+        llvm::errs() << name << " does not compile:\n" << error;
+        return false;
+    }
+
+    // the vectors alone, the empty one must print what answer holds
+    std::vector<std::string> expected;
+    for (const std::vector<int32_t> &inputs : vectors())
+    {
+        std::vector<int32_t> output;
+        program->run(inputs, output);
+        expected.push_back(joined(output));
+    }
+    if (expected[0] != answer)
+    {
+        llvm::errs() << name << ": printed '" << expected[0] << "', expected '" << answer << "'\n";
+        return false;
+    }
+
+    std::vector<std::string> failures(THREADS);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < THREADS; ++t)
+        threads.emplace_back([&, t]() { runAll(*program, expected, name, failures[t]); });
+    bool passed = true;
+    for (unsigned t = 0; t < THREADS; ++t)
+    {
+        threads[t].join();
+        llvm::errs() << failures[t];
+        passed = passed && failures[t].empty();
+    }
+    return passed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        llvm::errs() << "usage: " << argv[0] << " <answer> <test directory>\n";
+        return 2;
+    }
+    std::ifstream answers(argv[1]);
+    if (!answers)
+    {
+        llvm::errs() << argv[0] << ": cannot read " << argv[1] << "\n";
+        return 2;
+    }
+
+    unsigned programs = 0, failed = 0;
+    std::string number, answer;
+    while (answers >> number >> answer)
+    {
+        std::string path = std::string(argv[2]) + "/test" + number + ".c";
+        std::ifstream file(path);
+        if (!file)
+        {
+            llvm::errs() << argv[0] << ": cannot read " << path << "\n";
+            ++failed;
+            continue;
+        }
+        std::stringstream source;
+        source << file.rdbuf();
+        ++programs;
+        if (!check(number, answer, source.str(), true) || !check(number, answer, source.str(), false))
+            ++failed;
+    }
+    llvm::outs() << programs << " programs, " << failed << " failed\n";
+    return failed ? 1 : 0;
+}
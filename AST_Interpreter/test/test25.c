@@ -0,0 +1,36 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int find(int n) {
+   int i;
+   for (i = 0; i < 100; i = i + 1) {
+      if (i == n)
+         return i;
+   }
+   return -1;
+}
+
+int main() {
+   int i, sum;
+   sum = 0;
+   for (i = 0; i < 10; i = i + 1) {
+      if (i == 3)
+         continue;
+      if (i == 7)
+         break;
+      sum = sum + i;
+   }
+   PRINT(sum);
+
+   i = 0;
+   while (i < 100) {
+      i = i + 1;
+      if (i > 4)
+         break;
+   }
+   PRINT(i);
+   PRINT(find(42));
+   return 0;
+}
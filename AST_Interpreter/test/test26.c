@@ -0,0 +1,32 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int calls = 0;
+
+int bump() {
+   calls = calls + 1;
+   return calls;
+}
+
+int main() {
+   int x;
+   int n;
+   x = 0;
+   if (0)
+      x = 100;
+   if (1)
+      x = x + 7;
+   else
+      x = x + 200;
+   while (0)
+      x = x + 1000;
+   // the call must still run although its product is known
+   n = bump() * 0;
+   n = 0 * bump() + n;
+   x = x + n + calls * 10;
+   x = x + (2 + 3) * (sizeof(int) * 4 - sizeof(int *)) - (1 - 1) * x;
+   PRINT(x);
+   return 0;
+}
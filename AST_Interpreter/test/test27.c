@@ -0,0 +1,45 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int counter = 0;
+
+int fib(int n) {
+   if (n < 2)
+      return n;
+   return fib(n - 1) + fib(n - 2);
+}
+
+// reads and writes a global, every call must run
+int tick(int n) {
+   counter = counter + 1;
+   return n + counter;
+}
+
+// calls a builtin, every call must print
+int echo(int n) {
+   PRINT(n);
+   return n;
+}
+
+int sumTo(int n, int acc) {
+   if (n == 0)
+      return acc;
+   return sumTo(n - 1, acc + n);
+}
+
+int main() {
+   int a;
+   int b;
+   PRINT(fib(25));
+   a = tick(1);
+   b = tick(1);
+   PRINT(a * 10 + b);
+   echo(7);
+   echo(7);
+   a = sumTo(100, 0);
+   b = sumTo(100, 0) + sumTo(99, 100);
+   PRINT(a + b);
+   return 0;
+}
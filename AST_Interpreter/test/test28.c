@@ -0,0 +1,54 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int steps = 0;
+int scribbles = 0;
+
+// a million calls deep, fits the stack only if every call takes over its caller's frame
+int count(int n, int acc) {
+   steps = steps + 1;
+   if (n == 0)
+      return acc;
+   return count(n - 1, acc + 3);
+}
+
+// scribbles over whatever storage a freed frame left behind, the global
+// keeps it from being memoized
+int noise() {
+   int b[100];
+   int i;
+   scribbles = scribbles + 1;
+   i = 0;
+   while (i < 100) {
+      b[i] = 1000;
+      i = i + 1;
+   }
+   return b[0] - 1000;
+}
+
+int total(int *a, int i, int acc) {
+   if (i == 0)
+      return acc;
+   return total(a, i - 1, acc + noise() + a[i - 1]);
+}
+
+// the array is passed on, this frame must outlive the call in tail position
+int fill(int n) {
+   int a[100];
+   int i;
+   i = 0;
+   while (i < 100) {
+      a[i] = n + i;
+      i = i + 1;
+   }
+   return total(a, 100, 0);
+}
+
+int main() {
+   PRINT(count(1000000, 0));
+   PRINT(fill(1));
+   PRINT(steps + scribbles);
+   return 0;
+}
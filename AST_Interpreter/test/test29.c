@@ -0,0 +1,82 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   int *a;
+   int *b;
+   int *c;
+   int *d;
+   int *e;
+   int *z;
+   int *big;
+   int i;
+   int checks;
+   int sum;
+   checks = 0;
+   sum = 0;
+   a = (int *)MALLOC(4 * sizeof(int));
+   b = (int *)MALLOC(100 * sizeof(int));
+   c = (int *)MALLOC(4 * sizeof(int));
+   i = 0;
+   while (i < 4) {
+      a[i] = i + 1;
+      c[i] = 10 * (i + 1);
+      i = i + 1;
+   }
+   i = 0;
+   while (i < 100) {
+      b[i] = 7;
+      i = i + 1;
+   }
+   FREE(b);
+
+   // a smaller size class must not get the freed block, the same class reuses it
+   d = (int *)MALLOC(4 * sizeof(int));
+   if (d != b)
+      checks = checks + 1;
+   e = (int *)MALLOC(90 * sizeof(int));
+   if (e == b)
+      checks = checks + 1;
+   i = 0;
+   while (i < 4) {
+      d[i] = 5;
+      i = i + 1;
+   }
+   i = 0;
+   while (i < 90) {
+      e[i] = i;
+      i = i + 1;
+   }
+
+   z = (int *)MALLOC(0);
+   if (z != 0)
+      checks = checks + 1;
+   FREE(z);
+
+   big = (int *)MALLOC(1000000 * sizeof(int));
+   big[0] = 3;
+   big[999999] = 4;
+
+   // the neighbours of freed and reused blocks keep their data
+   i = 0;
+   while (i < 4) {
+      sum = sum + a[i] + c[i] + d[i];
+      i = i + 1;
+   }
+   i = 0;
+   while (i < 90) {
+      sum = sum + e[i];
+      i = i + 1;
+   }
+   sum = sum + big[0] + big[999999];
+   FREE(a);
+   FREE(c);
+   FREE(d);
+   FREE(e);
+   FREE(big);
+   PRINT(checks);
+   PRINT(sum);
+   return 0;
+}
@@ -0,0 +1,27 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int main() {
+   char c[26];
+   int i;
+   int sum;
+   i = 0;
+   while (i < 26) {
+      c[i] = 'a' + i;
+      i = i + 1;
+   }
+   c[0] = 65;
+   c[1] = 'B';
+   c[25] = -1;
+   sum = 0;
+   i = 0;
+   while (i < 26) {
+      sum = sum + c[i];
+      i = i + 1;
+   }
+   PRINT(sum);
+   PRINT(c[2] + sizeof(char) * 26);
+   return 0;
+}
@@ -0,0 +1,69 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// a while loop, never vectorized
+int total(int *x, int n) {
+   int i;
+   int s;
+   i = 0;
+   s = 0;
+   while (i < n) {
+      s = s + x[i] * (i + 1);
+      i = i + 1;
+   }
+   return s;
+}
+
+int main() {
+   int a[40];
+   int b[40];
+   int c[40];
+   int *p;
+   int i;
+   int n;
+   int k;
+   int s;
+   n = 40;
+   k = 3;
+   i = 0;
+   while (i < n) {
+      a[i] = i * i;
+      b[i] = 50 - i;
+      c[i] = 0;
+      i = i + 1;
+   }
+
+   for (i = 0; i < n; i = i + 1)
+      c[i] = a[i] + b[i];
+   PRINT(total(c, n));
+   for (i = 0; i < n; i = i + 1)
+      c[i] = a[i] - b[i];
+   PRINT(total(c, n));
+   for (i = 0; i < n; i = i + 1)
+      c[i] = a[i] * b[i];
+   PRINT(total(c, n));
+   for (i = 0; i < n; i = i + 1)
+      c[i] = k - a[i];
+   PRINT(total(c, n));
+   for (i = 0; i < n; i = i + 1)
+      c[i] = b[i] * 5;
+   PRINT(total(c, n));
+   s = 7;
+   for (i = 0; i < n; i = i + 1)
+      s = s + c[i];
+   PRINT(s);
+
+   // too short for the vector kernels
+   for (i = 0; i < 5; i = i + 1)
+      c[i] = a[i] + b[i];
+   PRINT(total(c, n));
+
+   // each element reads the one the previous iteration wrote, must stay scalar
+   p = a + 1;
+   for (i = 0; i < 39; i = i + 1)
+      p[i] = a[i] + 1;
+   PRINT(total(a, n));
+   return 0;
+}
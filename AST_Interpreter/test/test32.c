@@ -0,0 +1,29 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+int scale(int x, int k) {
+   return x * k + 1;
+}
+
+int main() {
+   int n;
+   int i;
+   int sum;
+   n = GET();
+   if (n < 0) {
+      PRINT(n);
+      PRINT(100 / (n + 1));
+      return 0;
+   }
+   sum = 0;
+   i = 0;
+   while (i < n) {
+      sum = sum + scale(GET(), i);
+      i = i + 1;
+   }
+   PRINT(n);
+   PRINT(sum);
+   return 0;
+}